@@ -0,0 +1,47 @@
+#include "backoff.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace janus {
+
+Backoff::Backoff(uint32_t initial_ms, uint32_t max_ms, double multiplier,
+		 double jitter, uint32_t max_attempts)
+	: initial_ms_(initial_ms),
+	  max_ms_(max_ms),
+	  multiplier_(multiplier),
+	  jitter_(jitter),
+	  max_attempts_(max_attempts),
+	  attempts_(0),
+	  rng_(std::random_device{}())
+{
+}
+
+uint32_t Backoff::NextDelay()
+{
+	double base = initial_ms_ * std::pow(multiplier_, (double)attempts_);
+	base = std::min(base, (double)max_ms_);
+	attempts_++;
+
+	// spread the retries of many outputs so they do not hit janus at once
+	std::uniform_real_distribution<double> dist(1.0 - jitter_,
+						    1.0 + jitter_);
+	return (uint32_t)std::max(0.0, base * dist(rng_));
+}
+
+bool Backoff::Exhausted() const
+{
+	return max_attempts_ > 0 && attempts_ >= max_attempts_;
+}
+
+uint32_t Backoff::Attempts() const
+{
+	return attempts_;
+}
+
+void Backoff::Reset()
+{
+	attempts_ = 0;
+}
+
+} // namespace janus
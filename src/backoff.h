@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+namespace janus {
+// jittered exponential backoff for reconnect attempts:
+// delay = min(max_ms, initial_ms * multiplier ^ attempt) +/- jitter
+class Backoff {
+public:
+	Backoff(uint32_t initial_ms = 500, uint32_t max_ms = 30 * 1000,
+		double multiplier = 2.0, double jitter = 0.3,
+		uint32_t max_attempts = 12);
+
+	// delay before the next attempt, in milliseconds
+	uint32_t NextDelay();
+	// true if all attempts have been used up
+	bool Exhausted() const;
+	uint32_t Attempts() const;
+	// call this after a successful attempt
+	void Reset();
+
+private:
+	uint32_t initial_ms_;
+	uint32_t max_ms_;
+	double multiplier_;
+	double jitter_;
+	uint32_t max_attempts_;
+	uint32_t attempts_;
+	std::mt19937 rng_;
+};
+} // namespace janus
@@ -0,0 +1,200 @@
+#include "deflate_extension.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "websocketpp/extensions/permessage_deflate/enabled.hpp"
+
+namespace janus::signaling {
+
+namespace pmd_error = websocketpp::extensions::permessage_deflate::error;
+
+// see `BindNext()`
+static thread_local DeflateOptions t_next_options_;
+static thread_local std::shared_ptr<DeflateCounters> t_next_counters_;
+
+// all the connections, for the summary at unload
+static DeflateCounters g_total_;
+
+// the processor feeds this trailer after the last frame of a message
+static const size_t kDeflateTrailerSize = 4;
+
+DeflateStats DeflateCounters::Stats() const
+{
+	return {raw_out, compressed_out, raw_in, compressed_in};
+}
+
+void DeflateExtension::BindNext(const DeflateOptions &options,
+				std::shared_ptr<DeflateCounters> counters)
+{
+	t_next_options_ = options;
+	t_next_options_.level = std::clamp(t_next_options_.level, 1, 9);
+	t_next_counters_ = std::move(counters);
+}
+
+DeflateStats DeflateExtension::Stats()
+{
+	return g_total_.Stats();
+}
+
+DeflateExtension::DeflateExtension()
+	: enabled_(false),
+	  deflate_ready_(false),
+	  inflate_ready_(false),
+	  client_no_context_takeover_(false),
+	  client_max_window_bits_(15)
+{
+	// the defaults if nothing was bound
+	options_ = t_next_options_;
+	counters_ = std::move(t_next_counters_);
+	t_next_options_ = DeflateOptions();
+	client_no_context_takeover_ = !options_.context_takeover;
+}
+
+DeflateExtension::~DeflateExtension()
+{
+	if (deflate_ready_)
+		deflateEnd(&dstate_);
+	if (inflate_ready_)
+		inflateEnd(&istate_);
+}
+
+std::string DeflateExtension::generate_offer() const
+{
+	std::string offer = "permessage-deflate; client_max_window_bits";
+	if (!options_.context_takeover) {
+		// ask the server to reset too, saves memory on both ends
+		offer += "; client_no_context_takeover";
+		offer += "; server_no_context_takeover";
+	}
+	return offer;
+}
+
+websocketpp::lib::error_code
+DeflateExtension::validate_offer(websocketpp::http::attribute_list const &)
+{
+	return websocketpp::lib::error_code();
+}
+
+websocketpp::err_str_pair
+DeflateExtension::negotiate(websocketpp::http::attribute_list const &attributes)
+{
+	websocketpp::err_str_pair ret;
+
+	for (auto &it : attributes) {
+		if (it.first == "client_no_context_takeover") {
+			client_no_context_takeover_ = true;
+		} else if (it.first == "client_max_window_bits") {
+			if (it.second.empty())
+				continue;
+			int bits = atoi(it.second.c_str());
+			if (bits < 8 || bits > 15) {
+				ret.first = pmd_error::make_error_code(
+					pmd_error::invalid_max_window_bits);
+				return ret;
+			}
+			// zlib can not produce a raw deflate stream with 8
+			client_max_window_bits_ = std::max(bits, 9);
+		} else if (it.first == "server_no_context_takeover" ||
+			   it.first == "server_max_window_bits") {
+			// inflating with the largest window handles any of them
+			continue;
+		} else {
+			ret.first = pmd_error::make_error_code(
+				pmd_error::invalid_attributes);
+			return ret;
+		}
+	}
+
+	ret.second = generate_offer();
+	return ret;
+}
+
+websocketpp::lib::error_code DeflateExtension::init(bool is_server)
+{
+	if (is_server)
+		return pmd_error::make_error_code(pmd_error::invalid_mode);
+
+	dstate_ = {};
+	int ret = deflateInit2(&dstate_, options_.level, Z_DEFLATED,
+			       -client_max_window_bits_, 8,
+			       Z_DEFAULT_STRATEGY);
+	if (ret != Z_OK)
+		return pmd_error::make_error_code(pmd_error::zlib_error);
+	deflate_ready_ = true;
+
+	istate_ = {};
+	ret = inflateInit2(&istate_, -15);
+	if (ret != Z_OK)
+		return pmd_error::make_error_code(pmd_error::zlib_error);
+	inflate_ready_ = true;
+
+	enabled_ = true;
+	return websocketpp::lib::error_code();
+}
+
+websocketpp::lib::error_code DeflateExtension::compress(std::string const &in,
+							std::string &out)
+{
+	if (!enabled_)
+		return pmd_error::make_error_code(pmd_error::uninitialized);
+
+	dstate_.avail_in = (uInt)in.size();
+	dstate_.next_in = (Bytef *)in.data();
+
+	size_t before = out.size();
+	do {
+		dstate_.avail_out = sizeof(buffer_);
+		dstate_.next_out = buffer_;
+		deflate(&dstate_, Z_SYNC_FLUSH);
+		out.append((char *)buffer_,
+			   sizeof(buffer_) - dstate_.avail_out);
+	} while (dstate_.avail_out == 0);
+
+	if (client_no_context_takeover_)
+		deflateReset(&dstate_);
+
+	// the processor strips the 4 bytes trailer before writing
+	uint64_t compressed = out.size() - before - kDeflateTrailerSize;
+	g_total_.raw_out += in.size();
+	g_total_.compressed_out += compressed;
+	if (counters_) {
+		counters_->raw_out += in.size();
+		counters_->compressed_out += compressed;
+	}
+
+	return websocketpp::lib::error_code();
+}
+
+websocketpp::lib::error_code
+DeflateExtension::decompress(uint8_t const *buf, size_t len, std::string &out)
+{
+	if (!enabled_)
+		return pmd_error::make_error_code(pmd_error::uninitialized);
+
+	istate_.avail_in = (uInt)len;
+	istate_.next_in = (Bytef *)buf;
+
+	size_t before = out.size();
+	do {
+		istate_.avail_out = sizeof(buffer_);
+		istate_.next_out = buffer_;
+		int ret = inflate(&istate_, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+			return pmd_error::make_error_code(
+				pmd_error::zlib_error);
+		out.append((char *)buffer_,
+			   sizeof(buffer_) - istate_.avail_out);
+	} while (istate_.avail_out == 0);
+
+	g_total_.compressed_in += len;
+	g_total_.raw_in += out.size() - before;
+	if (counters_) {
+		counters_->compressed_in += len;
+		counters_->raw_in += out.size() - before;
+	}
+
+	return websocketpp::lib::error_code();
+}
+
+} // namespace janus::signaling
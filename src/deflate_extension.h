@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <zlib.h>
+
+#include "websocketpp/common/system_error.hpp"
+#include "websocketpp/extensions/extension.hpp"
+#include "websocketpp/http/constants.hpp"
+
+namespace janus::signaling {
+struct DeflateOptions {
+	// zlib compression level, 1(fast) ~ 9(small)
+	int level = 6;
+	// keep the compression window across messages, better ratio for the
+	// repetitive janus json at the cost of ~64KB memory per direction
+	bool context_takeover = true;
+};
+
+// signaling bytes before & after compression
+struct DeflateStats {
+	uint64_t raw_out;
+	uint64_t compressed_out;
+	uint64_t raw_in;
+	uint64_t compressed_in;
+};
+
+// the counters of one client, updated by the io thread
+struct DeflateCounters {
+	std::atomic<uint64_t> raw_out{0};
+	std::atomic<uint64_t> compressed_out{0};
+	std::atomic<uint64_t> raw_in{0};
+	std::atomic<uint64_t> compressed_in{0};
+
+	DeflateStats Stats() const;
+};
+
+// client side permessage-deflate(RFC 7692) for websocketpp, used as the
+// `permessage_deflate_type` of the compressed endpoint configs, unlike
+// websocketpp's own implementation the level & context takeover are
+// configurable at runtime, per client
+class DeflateExtension {
+public:
+	DeflateExtension();
+	~DeflateExtension();
+
+	// websocketpp default-constructs the extension of a connection when it
+	// creates the processor, right after the tcp post-init handler on the
+	// same thread: the handler binds the options & counters of its client
+	// to the next extension created on the thread
+	static void BindNext(const DeflateOptions &options,
+			     std::shared_ptr<DeflateCounters> counters);
+	// of all the connections
+	static DeflateStats Stats();
+
+	// websocketpp extension interface
+	bool is_implemented() const { return true; }
+	bool is_enabled() const { return enabled_; }
+	std::string generate_offer() const;
+	websocketpp::lib::error_code
+	validate_offer(websocketpp::http::attribute_list const &offer);
+	websocketpp::err_str_pair
+	negotiate(websocketpp::http::attribute_list const &attributes);
+	websocketpp::lib::error_code init(bool is_server);
+	websocketpp::lib::error_code compress(std::string const &in,
+					      std::string &out);
+	websocketpp::lib::error_code decompress(uint8_t const *buf, size_t len,
+						std::string &out);
+
+private:
+	bool enabled_;
+	bool deflate_ready_;
+	bool inflate_ready_;
+	DeflateOptions options_;
+	std::shared_ptr<DeflateCounters> counters_;
+	// negotiated with the server
+	bool client_no_context_takeover_;
+	int client_max_window_bits_;
+
+	z_stream dstate_;
+	z_stream istate_;
+	unsigned char buffer_[16 * 1024];
+};
+} // namespace janus::signaling
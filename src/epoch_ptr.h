@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace janus {
+// a pointer read lock-free on the hot path & swapped by a writer which waits
+// for the readers of the old value to leave before handing it back,
+// epoch based: the readers register with the counter of the current epoch,
+// the writer flips the epoch & drains the counter of the previous one
+template<typename T> class EpochPtr {
+public:
+	class ReadGuard {
+	public:
+		ReadGuard(ReadGuard &&other) noexcept
+			: counter_(other.counter_), value_(other.value_)
+		{
+			other.counter_ = nullptr;
+		}
+		~ReadGuard()
+		{
+			if (counter_ != nullptr)
+				counter_->fetch_sub(1);
+		}
+		ReadGuard(const ReadGuard &) = delete;
+		ReadGuard &operator=(const ReadGuard &) = delete;
+
+		T *get() const { return value_; }
+		T *operator->() const { return value_; }
+		T &operator*() const { return *value_; }
+		explicit operator bool() const { return value_ != nullptr; }
+
+	private:
+		friend class EpochPtr;
+		ReadGuard(std::atomic<uint32_t> *counter, T *value)
+			: counter_(counter), value_(value)
+		{
+		}
+
+		std::atomic<uint32_t> *counter_;
+		T *value_;
+	};
+
+	EpochPtr() : value_(nullptr), epoch_(0)
+	{
+		readers_[0] = 0;
+		readers_[1] = 0;
+	}
+	EpochPtr(const EpochPtr &) = delete;
+	EpochPtr &operator=(const EpochPtr &) = delete;
+
+	// the value stays valid until the guard goes away, keep it short
+	ReadGuard Read()
+	{
+		for (;;) {
+			uint32_t epoch = epoch_.load();
+			auto counter = &readers_[epoch & 1];
+			counter->fetch_add(1);
+			// the writer flipped in between & may not wait for us
+			if (epoch_.load() == epoch)
+				return ReadGuard(counter, value_.load());
+			counter->fetch_sub(1);
+		}
+	}
+
+	// returns the previous value once no reader holds it anymore, blocks
+	// for as long as the slowest of them
+	T *Exchange(T *value)
+	{
+		std::lock_guard<std::mutex> lock(writer_mutex_);
+		T *old = value_.exchange(value);
+		uint32_t epoch = epoch_.fetch_add(1);
+		// the readers entering from here see the new value
+		while (readers_[epoch & 1].load() != 0)
+			std::this_thread::yield();
+		return old;
+	}
+
+private:
+	std::atomic<T *> value_;
+	std::atomic<uint32_t> epoch_;
+	std::atomic<uint32_t> readers_[2];
+	// one writer at a time, flips must not overlap
+	std::mutex writer_mutex_;
+};
+} // namespace janus
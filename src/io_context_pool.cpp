@@ -0,0 +1,118 @@
+#include "io_context_pool.h"
+
+#include <algorithm>
+#include <string>
+
+#include <util/base.h>
+#include <util/platform.h>
+
+#define blog(level, msg, ...) \
+	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
+
+namespace janus::signaling {
+
+// signaling traffic is tiny, a couple of threads serve a dozen outputs
+static const size_t kDefaultThreadCount = 2;
+static std::atomic<size_t> g_thread_count_{0};
+// the io_service run by the current thread, if any
+static thread_local const IoContextPool::IoService *t_io_service_ = nullptr;
+
+IoContextPool &IoContextPool::Instance()
+{
+	static IoContextPool pool;
+	return pool;
+}
+
+void IoContextPool::SetThreadCount(size_t count)
+{
+	g_thread_count_ = count;
+}
+
+IoContextPool::IoContextPool() : next_(0) {}
+
+IoContextPool::~IoContextPool()
+{
+	// threads must be stopped by `Shutdown()` before the module unloads
+	for (auto &t : threads_) {
+		if (t.joinable())
+			t.detach();
+	}
+}
+
+void IoContextPool::Start()
+{
+	size_t count = g_thread_count_;
+	if (count == 0)
+		count = std::min<size_t>(kDefaultThreadCount,
+					 std::max(1u,
+						  std::thread::hardware_concurrency()));
+
+	for (size_t i = 0; i < count; i++) {
+		auto service = std::make_shared<IoService>();
+		works_.push_back(std::make_unique<IoService::work>(*service));
+		IoService *s = service.get();
+		threads_.emplace_back([s, i]() {
+			std::string name = "janus-io-" + std::to_string(i);
+			os_set_thread_name(name.c_str());
+			t_io_service_ = s;
+			// a handler that throws must not take the thread &
+			// every connection on it down, `run()` resumes after it
+			while (true) {
+				try {
+					s->run();
+					break;
+				} catch (const std::exception &e) {
+					blog(LOG_ERROR, "%s: %s", name.c_str(),
+					     e.what());
+				} catch (...) {
+					blog(LOG_ERROR, "%s: unknown exception",
+					     name.c_str());
+				}
+			}
+		});
+		services_.push_back(std::move(service));
+	}
+
+	blog(LOG_INFO, "signaling io pool started with %zu threads", count);
+}
+
+std::shared_ptr<IoContextPool::IoService> IoContextPool::Next()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (services_.empty())
+		Start();
+
+	size_t index = next_++ % services_.size();
+	return services_[index];
+}
+
+size_t IoContextPool::ThreadCount()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return threads_.size();
+}
+
+bool IoContextPool::IsIoThread(const IoService &service)
+{
+	return t_io_service_ == &service;
+}
+
+void IoContextPool::Shutdown()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// let the io_services drain & return from `run()`
+	works_.clear();
+	for (auto &s : services_)
+		s->stop();
+	for (auto &t : threads_) {
+		if (t.joinable())
+			t.join();
+	}
+
+	threads_.clear();
+	// the connections still alive keep theirs, stopped
+	services_.clear();
+}
+
+} // namespace janus::signaling
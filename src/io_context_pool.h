@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "websocketpp/common/asio.hpp"
+
+namespace janus::signaling {
+// process-wide pool of io threads shared by every `WebsocketClient`,
+// each thread runs its own io_service so the handlers of one connection
+// always run in order on the same thread
+class IoContextPool {
+public:
+	typedef websocketpp::lib::asio::io_service IoService;
+
+	static IoContextPool &Instance();
+
+	// set the number of io threads, only takes effect before the pool
+	// is started by the first connection (0 means use the default)
+	static void SetThreadCount(size_t count);
+
+	// pick an io_service for a new connection(round-robin), shared with the
+	// connection so it outlives `Shutdown()` as long as the connection
+	std::shared_ptr<IoService> Next();
+	size_t ThreadCount();
+	// true if the caller is the io thread running `service`
+	static bool IsIoThread(const IoService &service);
+
+	// stop all io threads, call this from `obs_module_unload()`, the
+	// connections left can only be destroyed afterwards
+	void Shutdown();
+
+private:
+	IoContextPool();
+	~IoContextPool();
+
+	void Start();
+
+	std::mutex mutex_;
+	std::vector<std::shared_ptr<IoService>> services_;
+	std::vector<std::unique_ptr<IoService::work>> works_;
+	std::vector<std::thread> threads_;
+	std::atomic<size_t> next_;
+};
+} // namespace janus::signaling
@@ -33,6 +33,9 @@ bool obs_module_load(void)
 
 void obs_module_unload()
 {
+	ShutdownSignaling();
+	TerminateRTC();
+
 	blog(LOG_INFO, "[obs_module_unload] shut down.");
 }
 
@@ -57,6 +60,16 @@ bool janus_data_init(struct janus_data *data, struct janus_cfg *config)
 	if (!config->url || !*config->url)
 		return false;
 
+#ifndef USE_ENCODED_DATA
+	// one shared encode for all the destinations needs the encoded data
+	if (config->destinations && *config->destinations) {
+		data->last_error = bstrdup(
+			"Mirroring to extra rooms(fanout_destinations) needs "
+			"the encoded data build(USE_ENCODED_DATA)");
+		return false;
+	}
+#endif
+
 	data->initialized = true;
 
 	return true;
@@ -87,29 +100,269 @@ static inline const char *get_string_or_null(obs_data_t *settings,
 	return value;
 }
 
+// read the janus configs from the output settings, the strings are owned
+// by `settings`
+static void read_janus_cfg(obs_data_t *settings, struct janus_cfg *config)
+{
+	config->url = obs_data_get_string(settings, "url");
+	config->display = get_string_or_null(settings, "display");
+	config->room = (uint64_t)obs_data_get_int(settings, "room");
+	config->user_id = (uint32_t)obs_data_get_int(settings, "id");
+	config->pin = get_string_or_null(settings, "pin");
+	config->destinations =
+		get_string_or_null(settings, "fanout_destinations");
+	config->backup_urls = get_string_or_null(settings, "backup_urls");
+	config->warm_standby = obs_data_get_bool(settings, "warm_standby");
+	config->tls_verify = !obs_data_get_bool(settings, "tls_insecure");
+	config->tls_ca_file = get_string_or_null(settings, "tls_ca_file");
+	config->ws_compression = obs_data_get_bool(settings, "ws_compression");
+	config->ws_compression_level =
+		(int)obs_data_get_int(settings, "ws_compression_level");
+	config->ws_context_takeover =
+		!obs_data_get_bool(settings, "ws_no_context_takeover");
+	config->prewarm = obs_data_get_bool(settings, "prewarm");
+	config->hw_acceleration =
+		!obs_data_get_bool(settings, "no_hw_acceleration");
+	config->ice_servers = get_string_or_null(settings, "ice_servers");
+	config->ice_transport_policy =
+		get_string_or_null(settings, "ice_transport_policy");
+	config->ice_low_cost_only =
+		obs_data_get_bool(settings, "ice_low_cost_networks_only");
+	config->ice_disable_tcp = obs_data_get_bool(settings, "ice_disable_tcp");
+	config->ice_disable_ipv6 =
+		obs_data_get_bool(settings, "ice_disable_ipv6");
+	config->ice_candidate_pool_size =
+		(int)obs_data_get_int(settings, "ice_candidate_pool_size");
+	config->min_bitrate =
+		(uint32_t)obs_data_get_int(settings, "min_bitrate");
+	config->max_bitrate =
+		(uint32_t)obs_data_get_int(settings, "max_bitrate");
+	config->start_bitrate =
+		(uint32_t)obs_data_get_int(settings, "start_bitrate");
+	config->max_framerate = obs_data_get_double(settings, "max_framerate");
+	config->scale_down = obs_data_get_double(settings, "scale_down");
+	config->degradation_preference =
+		get_string_or_null(settings, "degradation_preference");
+
+	static const char *rids[] = {"h", "m", "l"};
+	// the janus.js defaults for m & l
+	static const double default_scales[] = {1.0, 2.0, 4.0};
+	static const uint32_t default_bitrates[] = {0, 500, 150};
+
+	config->video_codec = get_string_or_null(settings, "video_codec");
+	config->scalability_mode =
+		get_string_or_null(settings, "scalability_mode");
+
+	config->sdp_video_codecs =
+		get_string_or_null(settings, "sdp_video_codecs");
+	config->sdp_audio_codecs =
+		get_string_or_null(settings, "sdp_audio_codecs");
+	config->sdp_prune_codecs =
+		obs_data_get_bool(settings, "sdp_prune_codecs");
+	config->sdp_video_bandwidth =
+		(uint32_t)obs_data_get_int(settings, "sdp_video_bandwidth");
+	config->sdp_audio_bandwidth =
+		(uint32_t)obs_data_get_int(settings, "sdp_audio_bandwidth");
+	config->sdp_rtx = !obs_data_get_bool(settings, "disable_rtx");
+
+	config->nack = !obs_data_get_bool(settings, "disable_nack");
+	config->video_fec = get_string_or_null(settings, "video_fec");
+	config->audio_red = obs_data_get_bool(settings, "audio_red");
+	config->opus_fec = !obs_data_get_bool(settings, "disable_opus_fec");
+
+	config->simulcast_layers = 0;
+	if (obs_data_get_bool(settings, "simulcast")) {
+		int layers =
+			(int)obs_data_get_int(settings, "simulcast_layers");
+		config->simulcast_layers = layers == 2 ? 2 : 3;
+	}
+	for (int i = 0; i < 3; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "simulcast_bitrate_%s", rids[i]);
+		uint32_t bitrate = (uint32_t)obs_data_get_int(settings, name);
+		config->simulcast_bitrates[i] = bitrate ? bitrate
+							: default_bitrates[i];
+		snprintf(name, sizeof(name), "simulcast_scale_%s", rids[i]);
+		double scale = obs_data_get_double(settings, name);
+		config->simulcast_scales[i] = scale >= 1.0 ? scale
+							   : default_scales[i];
+	}
+}
+
+static void apply_signaling_options(void *conn, struct janus_cfg *config)
+{
+	// only used by wss:// urls
+	SetTlsOptions(conn, config->tls_verify, config->tls_ca_file);
+	SetSignalingCompression(conn, config->ws_compression,
+				config->ws_compression_level,
+				config->ws_context_takeover);
+}
+
+static void apply_encoding_options(void *conn, struct janus_cfg *config)
+{
+	SetEncodingParameters(conn, config->min_bitrate, config->max_bitrate,
+			      config->start_bitrate, config->max_framerate,
+			      config->scale_down,
+			      config->degradation_preference);
+	SetSimulcast(conn, config->simulcast_layers,
+		     config->simulcast_bitrates, config->simulcast_scales);
+	SetVideoCodec(conn, config->video_codec, config->scalability_mode);
+	SetSdpOptions(conn, config->sdp_video_codecs, config->sdp_audio_codecs,
+		      config->sdp_prune_codecs, config->sdp_video_bandwidth,
+		      config->sdp_audio_bandwidth, config->sdp_rtx);
+	SetLossResilience(conn, config->nack, config->video_fec,
+			  config->audio_red, config->opus_fec);
+}
+
+// every destination publishes the same feed with the same options
+static void apply_publish_options(void *conn, struct janus_cfg *config)
+{
+	apply_signaling_options(conn, config);
+	SetRTCFactoryConfig(conn, config->hw_acceleration, false);
+	SetIceOptions(conn, config->ice_servers, config->ice_transport_policy,
+		      config->ice_low_cost_only, config->ice_disable_tcp,
+		      config->ice_disable_ipv6,
+		      config->ice_candidate_pool_size);
+	apply_encoding_options(conn, config);
+}
+
+// the `JanusConnection` publishing to the primary room, it changes on
+// failover, do not keep it
+static void *primary_conn(struct janus_output *output)
+{
+	if (output->publisher == NULL)
+		return NULL;
+	return GetPublisherConnection(output->publisher, 0);
+}
+
+// open the signaling connection & attach a videoroom handle right away,
+// so starting the output only has to join the room & negotiate
+static void prewarm(struct janus_output *output, obs_data_t *settings)
+{
+	struct janus_cfg config = {0};
+	read_janus_cfg(settings, &config);
+
+	void *conn = primary_conn(output);
+	if (!config.prewarm || !config.url || !*config.url || conn == NULL)
+		return;
+
+	apply_signaling_options(conn, &config);
+	Prewarm(conn, config.url);
+}
+
 static const char *janus_output_getname(void *unused)
 {
 	UNUSED_PARAMETER(unused);
 	return obs_module_text("janus-videoroom output");
 }
 
+// proc handler: void get_publish_timeline(out string timeline)
+static void janus_output_get_publish_timeline(void *data, calldata_t *cd)
+{
+	struct janus_output *output = data;
+	void *conn = primary_conn(output);
+	char timeline[512];
+
+	if (conn == NULL ||
+	    !GetPublishTimeline(conn, timeline, sizeof(timeline)))
+		return;
+	calldata_set_string(cd, "timeline", timeline);
+}
+
+// proc handler: void get_stats(out string stats)
+static void janus_output_get_stats(void *data, calldata_t *cd)
+{
+	struct janus_output *output = data;
+	void *conn = primary_conn(output);
+	if (conn == NULL)
+		return;
+
+	char *stats = GetStatsJson(conn);
+	calldata_set_string(cd, "stats", stats);
+	bfree(stats);
+}
+
+// proc handler: void get_link_health(out string health)
+static void janus_output_get_link_health(void *data, calldata_t *cd)
+{
+	struct janus_output *output = data;
+	void *conn = primary_conn(output);
+	if (conn == NULL)
+		return;
+
+	char *health = GetLinkHealth(conn);
+	calldata_set_string(cd, "health", health);
+	bfree(health);
+}
+
+// janus rejected the publish, e.g. a wrong pin, & no backup server took it
+static void janus_output_publish_failed(void *param, const char *reason)
+{
+	struct janus_output *output = param;
+	obs_output_set_last_error(output->output, reason);
+	obs_output_signal_stop(output->output, OBS_OUTPUT_ERROR);
+}
+
 static void *janus_output_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct janus_output *data = bzalloc(sizeof(struct janus_output));
 	data->output = output;
-	data->janus_conn = NULL;
+	data->publisher = NULL;
+
+	// libwebrtc is only loaded once a janus output exists, warm it up off
+	// the main thread, it takes hundreds of ms
+	InitializeRTCAsync();
+
+	// size of the io thread pool shared by all outputs' signaling
+	SetSignalingThreadCount(
+		(int)obs_data_get_int(settings, "signaling_threads"));
 
 	// here create janus connection instance
 #ifdef USE_ENCODED_DATA
-	data->janus_conn = CreateConncetion(true);
+	data->publisher = CreatePublisher(true);
 #else
-	data->janus_conn = CreateConncetion(false);
+	data->publisher = CreatePublisher(false);
 #endif // USE_ENCODED_DATA
+	SetPublisherFailedCallback(data->publisher,
+				   janus_output_publish_failed, data);
+
+	prewarm(data, settings);
+
+	proc_handler_t *ph = obs_output_get_proc_handler(output);
+	proc_handler_add(ph, "void get_publish_timeline(out string timeline)",
+			 janus_output_get_publish_timeline, data);
+	proc_handler_add(ph, "void get_stats(out string stats)",
+			 janus_output_get_stats, data);
+	proc_handler_add(ph, "void get_link_health(out string health)",
+			 janus_output_get_link_health, data);
 
-	UNUSED_PARAMETER(settings);
 	return data;
 }
 
+static void janus_output_update(void *data, obs_data_t *settings)
+{
+	struct janus_output *output = data;
+
+	// the server may have changed, keep the warm session on the new one
+	if (!os_atomic_load_bool(&output->active)) {
+		prewarm(output, settings);
+		return;
+	}
+
+	// bitrate, frame rate & resolution apply live without renegotiating
+	if (output->publisher != NULL) {
+		struct janus_cfg config = {0};
+		read_janus_cfg(settings, &config);
+		int count = GetPublisherConnectionCount(output->publisher);
+		for (int i = 0; i < count; i++) {
+			void *conn =
+				GetPublisherConnection(output->publisher, i);
+			if (conn != NULL)
+				apply_encoding_options(conn, &config);
+		}
+	}
+}
+
 static bool janus_output_start(void *data)
 {
 	struct janus_output *output = data;
@@ -119,7 +372,7 @@ static bool janus_output_start(void *data)
 	output->connecting = true;
 
 	// get janus configs & connect to janus ws server
-	if (!try_connect(output)) {
+	if (!IsRTCAvailable() || !try_connect(output)) {
 		obs_output_signal_stop(output->output,
 				       OBS_OUTPUT_CONNECT_FAILED);
 		output->connecting = false;
@@ -140,9 +393,9 @@ static void janus_output_destroy(void *data)
 {
 	struct janus_output *output = data;
 	if (output) {
-		if (output->janus_conn != NULL) {
-			DestoryConnection(output->janus_conn);
-			output->janus_conn = NULL;
+		if (output->publisher != NULL) {
+			DestoryPublisher(output->publisher);
+			output->publisher = NULL;
 		}
 
 		janus_output_full_stop(output);
@@ -174,9 +427,9 @@ static void janus_output_stop(void *data, uint64_t ts)
 	//}
 	//cleanup(codec_context, format_context);
 
-	// Unpublish
-	if (output->janus_conn != NULL) {
-		Unpublish(output->janus_conn);
+	// Unpublish, does not wait for the peerconnections to close
+	if (output->publisher != NULL) {
+		PublisherUnpublish(output->publisher);
 	}
 
 	if (output->active) {
@@ -197,9 +450,20 @@ static void janus_deactivate(struct janus_output *output)
 static uint64_t janus_output_total_bytes(void *data)
 {
 	struct janus_output *output = data;
+	// keep the last value after the connection stopped publishing
+	if (output->publisher != NULL && os_atomic_load_bool(&output->active))
+		output->total_bytes = GetPublisherTotalBytes(output->publisher);
 	return output->total_bytes;
 }
 
+static int janus_output_dropped_frames(void *data)
+{
+	struct janus_output *output = data;
+	if (output->publisher == NULL)
+		return 0;
+	return GetPublisherDroppedFrames(output->publisher);
+}
+
 static bool try_connect(struct janus_output *output)
 {
 	struct janus_cfg config = {0};
@@ -208,11 +472,7 @@ static bool try_connect(struct janus_output *output)
 	// get settings from fronted api
 	// janus configs
 	obs_data_t *settings = obs_output_get_settings(output->output);
-	config.url = obs_data_get_string(settings, "url");
-	config.display = get_string_or_null(settings, "display");
-	config.room = (uint64_t)obs_data_get_int(settings, "room");
-	config.user_id = (uint32_t)obs_data_get_int(settings, "id");
-	config.pin = get_string_or_null(settings, "pin");
+	read_janus_cfg(settings, &config);
 
 	// a/v configs
 	config.width = (int)obs_output_get_width(output->output);
@@ -255,10 +515,22 @@ static bool try_connect(struct janus_output *output)
 	obs_output_begin_data_capture(output->output, 0);
 	// will call `obs_output_end_data_capture()` in `janus_output_full_stop()`
 
-	if (output->janus_conn != NULL) {
+	if (output->publisher != NULL) {
+		SetPublisherDestinations(output->publisher,
+					 config.destinations);
+		SetPublisherFailover(output->publisher, config.backup_urls,
+				     config.warm_standby);
+		int count = GetPublisherConnectionCount(output->publisher);
+		for (int i = 0; i < count; i++) {
+			void *conn =
+				GetPublisherConnection(output->publisher, i);
+			if (conn != NULL)
+				apply_publish_options(conn, &config);
+		}
+
 		// start publishing...
-		Publish(output->janus_conn, config.url, config.user_id,
-			config.display, config.room, config.pin);
+		PublisherPublish(output->publisher, config.url, config.user_id,
+				 config.display, config.room, config.pin);
 	}
 
 	// init ffmpeg audio info(audio encoding test)
@@ -276,9 +548,9 @@ static bool try_connect(struct janus_output *output)
 static void receive_audio(void *param, struct audio_data *a_frame)
 {
 	struct janus_output *output = param;
-	if (output->janus_conn != NULL) {
-		// send audio frame to janus connection
-		SendAudioFrame(output->janus_conn, a_frame);
+	if (output->publisher != NULL) {
+		// send audio frame to janus connections
+		PublisherSendAudioFrame(output->publisher, a_frame);
 	}
 
 	// encode raw data to xxx.aac
@@ -312,11 +584,11 @@ static void receive_audio(void *param, struct audio_data *a_frame)
 static void receive_video(void *param, struct video_data *frame)
 {
 	struct janus_output *output = param;
-	if (output->janus_conn != NULL) {
-		// send video frame to janus connection
-		SendVideoFrame(output->janus_conn, frame,
-			       output->js_data.config.width,
-			       output->js_data.config.height);
+	if (output->publisher != NULL) {
+		// send video frame to janus connections
+		PublisherSendVideoFrame(output->publisher, frame,
+					output->js_data.config.width,
+					output->js_data.config.height);
 	}
 }
 
@@ -325,11 +597,12 @@ static void receive_encoded_data(void *data, struct encoder_packet *packet)
 	struct janus_output *output = data;
 
 	if (packet->type == OBS_ENCODER_VIDEO) {
-		if (output->janus_conn != NULL) {
-			// send encoded packet to janus connection
-			SendVideoPacket(output->janus_conn, packet,
-					output->js_data.config.width,
-					output->js_data.config.height);
+		if (output->publisher != NULL) {
+			// send encoded packet to janus connections, obs encoded
+			// it once for all of them
+			PublisherSendVideoPacket(output->publisher, packet,
+						 output->js_data.config.width,
+						 output->js_data.config.height);
 		}
 	}
 
@@ -600,6 +873,7 @@ struct obs_output_info janus_output = {
 	.destroy = janus_output_destroy,
 	.start = janus_output_start,
 	.stop = janus_output_stop,
+	.update = janus_output_update,
 #ifdef USE_ENCODED_DATA
 	.flags = OBS_OUTPUT_VIDEO | OBS_OUTPUT_ENCODED,
 	.encoded_video_codecs = "h264",
@@ -611,4 +885,5 @@ struct obs_output_info janus_output = {
 	.raw_audio = receive_audio,
 #endif // USE_ENCODED_DATA
 	.get_total_bytes = janus_output_total_bytes,
+	.get_dropped_frames = janus_output_dropped_frames,
 };
@@ -27,6 +27,79 @@ struct janus_cfg {
 	uint32_t user_id;
 	// optional 
 	const char *pin;
+	// extra rooms the feed is mirrored to, one "url room [pin]" per line,
+	// same id & display, needs `USE_ENCODED_DATA`: the raw frames would be
+	// encoded once per destination, the output refuses to start otherwise
+	const char *destinations;
+	// servers the room fails over to, one url per line, tried in order
+	const char *backup_urls;
+	// keep a session & handle attached on the next backup server
+	bool warm_standby;
+
+	// wss:// only, verify the server certificate
+	bool tls_verify;
+	// optional CA bundle(PEM) to trust, e.g. a self-signed janus
+	const char *tls_ca_file;
+
+	// permessage-deflate for the signaling connection
+	bool ws_compression;
+	// zlib level 1~9, 0 means default
+	int ws_compression_level;
+	bool ws_context_takeover;
+
+	// keep a janus session & handle ready before the output starts
+	bool prewarm;
+
+	// encode with the hardware encoder if available
+	bool hw_acceleration;
+
+	// one "uri [username password]" per line, "none" for no servers, NULL
+	// for the defaults
+	const char *ice_servers;
+	// all, relay or nohost
+	const char *ice_transport_policy;
+	bool ice_low_cost_only;
+	bool ice_disable_tcp;
+	bool ice_disable_ipv6;
+	int ice_candidate_pool_size;
+
+	// video sender encoding, kbps, 0 means let webrtc decide
+	uint32_t min_bitrate;
+	uint32_t max_bitrate;
+	uint32_t start_bitrate;
+	double max_framerate;
+	double scale_down;
+	// balanced, maintain-framerate or maintain-resolution
+	const char *degradation_preference;
+
+	// raw video only, 0 or 1 means no simulcast
+	int simulcast_layers;
+	// h, m & l, max kbps & resolution scale down of each layer
+	uint32_t simulcast_bitrates[3];
+	double simulcast_scales[3];
+
+	// raw video only, e.g. VP9 & L3T3_KEY, NULL for the defaults
+	const char *video_codec;
+	const char *scalability_mode;
+
+	// sdp rewrites, comma separated codecs moved to the front of the offer,
+	// e.g. "H264/profile-level-id=42e01f,VP8", NULL to keep the order
+	const char *sdp_video_codecs;
+	const char *sdp_audio_codecs;
+	// drop the codecs not listed
+	bool sdp_prune_codecs;
+	// kbps, b=AS & b=TIAS of the answer, 0 to keep them
+	uint32_t sdp_video_bandwidth;
+	uint32_t sdp_audio_bandwidth;
+	// keep the rtx payloads in the offer
+	bool sdp_rtx;
+
+	// loss resilience, retransmission on nack, video fec(none, ulpfec or
+	// flexfec, NULL for ulpfec), opus with RED & in-band fec
+	bool nack;
+	const char *video_fec;
+	bool audio_red;
+	bool opus_fec;
 
 	int width;
 	int height;
@@ -69,8 +142,9 @@ struct janus_output {
 	obs_output_t *output;
 
 	struct janus_data js_data;
-	// `JanusConnection` instance pointer
-	void *janus_conn;
+	// `JanusPublisher` instance pointer, feeds the primary connection, the
+	// connections of the extra destinations & the failover standby
+	void *publisher;
 
 	bool connecting;
 	volatile bool active;
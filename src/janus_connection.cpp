@@ -1,6 +1,12 @@
 #include "janus_connection.h"
 #include "nlohmann/json.hpp"
 
+#include <algorithm>
+#include <future>
+
+#define blog(level, msg, ...) \
+	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
+
 namespace janus {
 
 VideoFeederImpl::VideoFeederImpl()
@@ -13,13 +19,30 @@ VideoFeederImpl::~VideoFeederImpl()
 	frame_receiver_ = nullptr;
 }
 
+RTCVideoFrameRef VideoFeederImpl::WrapFrame(OBSVideoFrame *frame, int width,
+					    int height)
+{
+	return libwebrtc::RTCVideoFrame::Create(width, height, frame->data[0],
+						frame->data[1]);
+}
+
+RTCVideoFrameRef VideoFeederImpl::WrapPacket(OBSVideoPacket *pkt, int width,
+					     int height)
+{
+	return libwebrtc::RTCVideoFrame::Create(pkt->data, pkt->size,
+						pkt->keyframe, width, height);
+}
+
 void VideoFeederImpl::FeedVideoFrame(OBSVideoFrame *frame, int width,
 				     int height)
 {
-	auto v_frame = libwebrtc::RTCVideoFrame::Create(
-		width, height, frame->data[0], frame->data[1]);
+	FeedVideoFrame(WrapFrame(frame, width, height));
+}
+
+void VideoFeederImpl::FeedVideoFrame(const RTCVideoFrameRef &frame)
+{
 	if (frame_receiver_ != nullptr) {
-		frame_receiver_->OnFrame(v_frame);
+		frame_receiver_->OnFrame(frame);
 	}
 }
 
@@ -38,108 +61,637 @@ void VideoFeederImpl::SetBufferReceiver(
 void VideoFeederImpl::FeedVideoPacket(OBSVideoPacket *pkt, int width,
 				      int height)
 {
-	auto encoded_frame = libwebrtc::RTCVideoFrame::Create(
-		pkt->data, pkt->size, pkt->keyframe, width, height);
+	FeedVideoPacket(WrapPacket(pkt, width, height));
+}
+
+void VideoFeederImpl::FeedVideoPacket(const RTCVideoFrameRef &packet)
+{
 	if (packet_receiver_ != nullptr) {
-		packet_receiver_->OnPacket(encoded_frame);
+		packet_receiver_->OnPacket(packet);
 	}
 }
 
 /////////////////////////////////////////////////////////////////////////////////
 
 JanusConnection::JanusConnection(bool send_encoded_data)
-	: ws_client_(nullptr),
-	  rtc_client_(nullptr),
-	  video_feeder_(nullptr),
+	: video_feeder_(nullptr),
 	  room_(0),
+	  state_(JanusState::kNone),
 	  session_id_(0),
 	  handle_id_(0),
 	  id_(0),
-	  joined_room_(false),
-	  use_encoded_data_(send_encoded_data)
+	  signaling_compression_(false),
+	  default_ice_servers_(true),
+	  publishing_(false),
+	  prewarm_(false),
+	  connecting_(false),
+	  closing_(false),
+	  disconnected_ts_(0),
+	  keepalive_generation_(0),
+	  ice_restart_backoff_(1000, 10 * 1000, 2.0, 0.2, 6),
+	  ice_restart_generation_(0),
+	  ice_disconnected_ts_(0),
+	  bitrate_factor_(1.0),
+	  adapt_base_kbps_(0),
+	  adapt_generation_(0),
+	  send_kbps_(0),
+	  stats_generation_(0),
+	  stats_pending_(false),
+	  bytes_base_(0),
+	  dropped_base_(0),
+	  rtc_generation_(0),
+	  anchor_(std::make_shared<EpochPtr<JanusConnection>>()),
+	  use_encoded_data_(send_encoded_data),
+	  worker_("janus-worker"),
+	  rtc_worker_("janus-rtc", TaskQueuePool::Instance().Blocking())
 {
 	// get audio info from obs output
 	auto audio = obs_get_audio();
 	auto info = audio_output_get_info(audio);
 	channels_ = audio_output_get_channels(audio);
 	sample_rate_ = audio_output_get_sample_rate(audio);
-	// use custom audio input
-	rtc::SetCustomizedAudioInputEnabled(true);
+	// custom audio input is enabled when the peerconnection factory is
+	// created, see `rtc::CreateClient()`
+	anchor_->Exchange(this);
 }
 
 JanusConnection::~JanusConnection()
 {
+	// the pending libwebrtc callbacks find nothing from here on
+	anchor_->Exchange(nullptr);
+	closing_ = true;
+	// no more keep-alive or reconnect attempts from here
+	worker_.Stop();
+	rtc_worker_.Stop();
+
 	Disconnect();
 	DestoryRTCClient();
 }
 
+// releases the peerconnections & connections handed over by the obs
+// threads, created on first use
+static std::mutex g_teardown_mutex_;
+static std::unique_ptr<TaskQueue> g_teardown_;
+
+void JanusConnection::PostTeardown(TaskQueue::Task task)
+{
+	std::unique_lock<std::mutex> lock(g_teardown_mutex_);
+	if (g_teardown_ != nullptr && g_teardown_->IsCurrent()) {
+		// e.g. a connection deleted on the queue releases its client
+		lock.unlock();
+		task();
+		return;
+	}
+
+	if (g_teardown_ == nullptr)
+		g_teardown_ = std::make_unique<TaskQueue>("janus-teardown");
+	g_teardown_->Post(std::move(task));
+}
+
+void JanusConnection::Destroy(JanusConnection *conn)
+{
+	if (conn == nullptr)
+		return;
+
+	// no more work for it from the websocket & webrtc threads, nor calls
+	// into its owner
+	conn->closing_ = true;
+	conn->SetObserver(nullptr);
+	PostTeardown([conn]() {
+		uint64_t start = os_gettime_ns();
+		delete conn;
+		blog(LOG_DEBUG, "connection released in %llu ms",
+		     (unsigned long long)((os_gettime_ns() - start) / 1000000));
+	});
+}
+
+void JanusConnection::WaitForTeardown()
+{
+	std::unique_ptr<TaskQueue> queue;
+	{
+		std::lock_guard<std::mutex> lock(g_teardown_mutex_);
+		queue = std::move(g_teardown_);
+	}
+	if (queue == nullptr)
+		return;
+
+	// the tasks run in order, this one is the last
+	std::promise<void> done;
+	queue->Post([&done]() { done.set_value(); });
+	done.get_future().wait();
+	queue->Stop();
+}
+
+static const char *kJanusStateNames[] = {
+	"none",
+	"session",
+	"handle",
+	"joined",
+};
+static_assert(sizeof(kJanusStateNames) / sizeof(kJanusStateNames[0]) ==
+		      (size_t)JanusState::kCount,
+	      "a name for each state");
+
+const char *JanusConnection::StateName(JanusState state)
+{
+	if (state >= JanusState::kCount)
+		return "unknown";
+	return kJanusStateNames[(size_t)state];
+}
+
+void JanusConnection::SetState(JanusState state, const char *reason)
+{
+	JanusState old = state_.exchange(state);
+	if (old != state)
+		blog(LOG_DEBUG, "janus state %s -> %s (%s)", StateName(old),
+		     StateName(state), reason);
+}
+
+bool JanusConnection::AdvanceState(JanusState from, JanusState to,
+				   const char *reason)
+{
+	if (!state_.compare_exchange_strong(from, to))
+		return false;
+	blog(LOG_DEBUG, "janus state %s -> %s (%s)", StateName(from),
+	     StateName(to), reason);
+	return true;
+}
+
+bool JanusConnection::Joined() const
+{
+	return state_ == JanusState::kJoined;
+}
+
 void JanusConnection::Connect(const char *url)
 {
-	if (ws_client_ == nullptr) {
-		ws_client_ = new signaling::WebsocketClient();
-		ws_client_->AddObserver(this);
+	if (url != nullptr)
+		url_ = url;
+
+	auto ws_client = Signaling();
+	if (ws_client == nullptr) {
+		ws_client = std::make_shared<signaling::WebsocketClient>();
+		ws_client->AddObserver(this);
+		ws_client->SetTlsOptions(tls_options_);
+		ws_client->SetCompression(signaling_compression_,
+					  deflate_options_);
+		std::lock_guard<std::mutex> lock(ws_mutex_);
+		ws_client_ = ws_client;
 	}
-	ws_client_->Connect(url);
+	closing_ = false;
+	connecting_ = true;
+	ws_client->Connect(url_);
 }
 
 void JanusConnection::Disconnect()
 {
-	if (ws_client_ == nullptr)
+	std::shared_ptr<signaling::WebsocketClient> ws_client;
+	{
+		std::lock_guard<std::mutex> lock(ws_mutex_);
+		ws_client.swap(ws_client_);
+	}
+	if (ws_client == nullptr)
 		return;
 
-	ws_client_->Close();
-	delete ws_client_;
-	ws_client_ = nullptr;
+	closing_ = true;
+	ws_client->Close();
+	// no callbacks into `this` from it after this, it is released by
+	// whoever lets go of it last, e.g. an io callback still sending on it
+	ws_client->Detach();
+}
+
+std::shared_ptr<signaling::WebsocketClient> JanusConnection::Signaling() const
+{
+	std::lock_guard<std::mutex> lock(ws_mutex_);
+	return ws_client_;
+}
+
+bool JanusConnection::SendMsg(const std::string &msg,
+			      signaling::MessagePriority priority,
+			      bool droppable)
+{
+	auto ws_client = Signaling();
+	if (ws_client == nullptr)
+		return false;
+	return ws_client->SendMsg(msg, priority, droppable);
+}
+
+void JanusConnection::SetTlsOptions(const signaling::TlsOptions &options)
+{
+	tls_options_ = options;
+	auto ws_client = Signaling();
+	if (ws_client != nullptr)
+		ws_client->SetTlsOptions(options);
+}
+
+void JanusConnection::SetSignalingCompression(
+	bool enabled, const signaling::DeflateOptions &options)
+{
+	signaling_compression_ = enabled;
+	deflate_options_ = options;
+	auto ws_client = Signaling();
+	if (ws_client != nullptr)
+		ws_client->SetCompression(enabled, options);
+}
+
+void JanusConnection::SetFactoryConfig(const rtc::RTCFactoryConfig &config)
+{
+	factory_config_ = config;
+}
+
+void JanusConnection::SetIceSettings(const rtc::RTCIceSettings &ice,
+				     bool use_default_servers)
+{
+	std::lock_guard<std::mutex> lock(settings_mutex_);
+	ice_settings_ = ice;
+	default_ice_servers_ = use_default_servers;
+}
+
+void JanusConnection::SetEncodingSettings(
+	const rtc::RTCEncodingSettings &settings)
+{
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		auto layers = std::move(encoding_settings_.simulcast_layers);
+		auto scalability_mode =
+			std::move(encoding_settings_.scalability_mode);
+		auto video_codec = std::move(encoding_settings_.video_codec);
+		encoding_settings_ = settings;
+		encoding_settings_.simulcast_layers = std::move(layers);
+		encoding_settings_.scalability_mode =
+			std::move(scalability_mode);
+		encoding_settings_.video_codec = std::move(video_codec);
+	}
+	ApplyEncodingSettings();
+}
+
+void JanusConnection::SetSimulcastLayers(
+	const std::vector<rtc::RTCSimulcastLayer> &layers)
+{
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		encoding_settings_.simulcast_layers = layers;
+	}
+	ApplyEncodingSettings();
+}
+
+void JanusConnection::SetVideoCodec(const std::string &codec,
+				    const std::string &scalability_mode)
+{
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		encoding_settings_.video_codec = codec;
+		encoding_settings_.scalability_mode = scalability_mode;
+	}
+	ApplyEncodingSettings();
+}
+
+void JanusConnection::SetSdpOptions(const rtc::SdpMungeOptions &options)
+{
+	std::lock_guard<std::mutex> lock(settings_mutex_);
+	rtc::SdpMungeOptions resilience = sdp_options_;
+	sdp_options_ = options;
+	sdp_options_.nack = resilience.nack;
+	sdp_options_.ulpfec = resilience.ulpfec;
+	sdp_options_.flexfec = resilience.flexfec;
+	sdp_options_.audio_red = resilience.audio_red;
+	sdp_options_.opus_fec = resilience.opus_fec;
+}
+
+void JanusConnection::SetLossResilience(bool nack, bool ulpfec, bool flexfec,
+					bool audio_red, bool opus_fec)
+{
+	std::lock_guard<std::mutex> lock(settings_mutex_);
+	sdp_options_.nack = nack;
+	sdp_options_.ulpfec = ulpfec;
+	sdp_options_.flexfec = flexfec;
+	sdp_options_.audio_red = audio_red;
+	sdp_options_.opus_fec = opus_fec;
+}
+
+std::string JanusConnection::VideoCodecOfRoom()
+{
+	std::lock_guard<std::mutex> lock(settings_mutex_);
+	std::string codec = encoding_settings_.video_codec;
+	// janus uses lower case codec names
+	std::transform(codec.begin(), codec.end(), codec.begin(),
+		       [](unsigned char c) { return (char)tolower(c); });
+	return codec;
 }
 
 void JanusConnection::OnConnected()
 {
-	// create janus sesssion
-	CreateSession();
+	connecting_ = false;
+	MarkPhase(PublishPhase::kWebsocketConnected);
+	if (state_ != JanusState::kNone) {
+		// the connection dropped, try to take over the old session
+		ClaimSession();
+	} else {
+		// create janus sesssion
+		CreateSession();
+	}
 }
 
 void JanusConnection::OnConnectionClosed(const std::string &reason)
 {
-	joined_room_ = false;
-	InvalidKeepaliveThread();
+	connecting_ = false;
+	StopKeepalive();
+
+	if (closing_ || (!publishing_ && !prewarm_)) {
+		// the handle may be claimed back, the room is joined again
+		AdvanceState(JanusState::kJoined, JanusState::kHandle,
+			     "signaling closed");
+		return;
+	}
+
+	// keep the session, handle & peerconnection, media keeps flowing
+	// while we try to get the signaling connection back
+	if (disconnected_ts_ == 0) {
+		disconnected_ts_ = os_gettime_ns();
+		blog(LOG_WARNING, "signaling connection lost: %s",
+		     reason.c_str());
+		if (publishing_)
+			NotifyPathDown("signaling lost: " + reason);
+	}
+	ScheduleReconnect();
+}
+
+void JanusConnection::SetObserver(JanusConnectionObserver *observer)
+{
+	observer_.Exchange(observer);
+}
+
+void JanusConnection::NotifyPathDown(const std::string &reason)
+{
+	auto observer = observer_.Read();
+	if (observer)
+		observer->OnPathDown(this, reason);
+}
+
+void JanusConnection::FailPublish(const std::string &reason)
+{
+	blog(LOG_ERROR, "publish to room %llu on %s failed: %s",
+	     (unsigned long long)room_, url_.c_str(), reason.c_str());
+
+	// nothing goes out anymore, the handle stays attached for the next
+	// `Publish()`
+	publishing_ = false;
+	disconnected_ts_ = 0;
+	reconnect_backoff_.Reset();
+	StopAdaptation();
+	link_health_.Stop();
+	DestoryRTCClient();
+
+	auto observer = observer_.Read();
+	if (observer)
+		observer->OnPublishFailed(this, reason);
+}
+
+bool JanusConnection::Publishing() const
+{
+	return publishing_;
+}
+
+void JanusConnection::ScheduleReconnect()
+{
+	if (reconnect_backoff_.Exhausted()) {
+		blog(LOG_ERROR,
+		     "giving up reconnecting to %s after %u attempts",
+		     url_.c_str(), reconnect_backoff_.Attempts());
+		session_id_ = 0;
+		handle_id_ = 0;
+		SetState(JanusState::kNone, "reconnect gave up");
+		auto ws_client = Signaling();
+		if (ws_client != nullptr)
+			ws_client->ClearQueue();
+		// the owner fails over or stops, a pre-warmed session is just
+		// started over by the next `Publish()`
+		if (publishing_) {
+			FailPublish("signaling lost");
+		} else {
+			reconnect_backoff_.Reset();
+			disconnected_ts_ = 0;
+		}
+		return;
+	}
+
+	uint32_t delay = reconnect_backoff_.NextDelay();
+	blog(LOG_INFO, "reconnecting to %s in %u ms (attempt %u)",
+	     url_.c_str(), delay, reconnect_backoff_.Attempts());
+
+	worker_.PostDelayed(
+		[this]() {
+			auto ws_client = Signaling();
+			if (closing_ || (!publishing_ && !prewarm_) ||
+			    ws_client == nullptr)
+				return;
+			connecting_ = true;
+			ws_client->Connect(url_);
+		},
+		delay);
+}
+
+void JanusConnection::LogRecovery(const char *how)
+{
+	if (disconnected_ts_ == 0)
+		return;
+
+	uint64_t elapsed = os_gettime_ns() - disconnected_ts_;
+	blog(LOG_INFO, "signaling recovered in %llu ms (%s, %u attempts)",
+	     (unsigned long long)(elapsed / 1000000), how,
+	     reconnect_backoff_.Attempts());
+	disconnected_ts_ = 0;
+	reconnect_backoff_.Reset();
+}
+
+void JanusConnection::ClaimSession()
+{
+	nlohmann::json payload = {{"janus", "claim"},
+				  {"transaction", "Claim"},
+				  {"session_id", session_id_.load()}};
+	std::string msg = payload.dump();
+	// ahead of anything queued for the session while we were away
+	SendMsg(msg, signaling::MessagePriority::kFirst);
+}
+
+void JanusConnection::OnSessionLost()
+{
+	blog(LOG_WARNING, "session %llu expired, re-joining the room",
+	     (unsigned long long)session_id_.load());
+
+	// janus has released the handle & its peerconnection
+	session_id_ = 0;
+	handle_id_ = 0;
+	SetState(JanusState::kNone, "session lost");
+	// trickles & requests queued for the dead handle
+	auto ws_client = Signaling();
+	if (ws_client != nullptr)
+		ws_client->ClearQueue();
+	DestoryRTCClient();
+
+	// `Attach` success will publish again
+	CreateSession();
+}
+
+// the fields of a janus message, false if missing or of another type
+static bool StringField(const nlohmann::json &json, const char *key,
+			std::string &value)
+{
+	auto it = json.find(key);
+	if (it == json.end() || !it->is_string())
+		return false;
+	value = it->get<std::string>();
+	return true;
+}
+
+// `{"data": {"id": ...}}` of the create & attach replies
+static bool DataId(const nlohmann::json &json, uint64_t &id)
+{
+	auto data = json.find("data");
+	if (data == json.end() || !data->is_object())
+		return false;
+	auto it = data->find("id");
+	if (it == data->end() || !it->is_number_unsigned())
+		return false;
+	id = it->get<uint64_t>();
+	return true;
+}
+
+// `{"jsep": {"sdp": ...}}`
+static bool JsepSdp(const nlohmann::json &json, std::string &sdp)
+{
+	auto jsep = json.find("jsep");
+	return jsep != json.end() && jsep->is_object() &&
+	       StringField(*jsep, "sdp", sdp);
 }
 
 void JanusConnection::OnRecvMessage(const std::string &msg)
 {
-	auto json = nlohmann::json::parse(msg);
-	if (json.contains("transaction") && json.contains("janus")) {
-		std::string transaction = json["transaction"];
-		std::string janus = json["janus"];
+	// on the io thread, nothing janus sends may throw out of here
+	auto json = nlohmann::json::parse(msg, nullptr, false);
+	if (json.is_discarded() || !json.is_object()) {
+		blog(LOG_WARNING, "malformed message dropped: %.64s",
+		     msg.c_str());
+		return;
+	}
+
+	try {
+		OnJanusMessage(json);
+	} catch (const nlohmann::json::exception &e) {
+		blog(LOG_WARNING, "unexpected message dropped(%s): %.64s",
+		     e.what(), msg.c_str());
+	}
+}
+
+void JanusConnection::OnJanusMessage(const nlohmann::json &json)
+{
+	std::string transaction;
+	std::string janus;
+	if (!StringField(json, "janus", janus))
+		return;
 
+	if (StringField(json, "transaction", transaction)) {
 		if (transaction == "Create" && janus == "success") {
-			uint64_t session_id = json["data"]["id"];
+			uint64_t session_id;
+			if (!DataId(json, session_id))
+				return;
 			session_id_ = session_id;
+			SetState(JanusState::kSession, "created");
+			MarkPhase(PublishPhase::kSessionCreated);
 			// get handle ID
 			CreateHandle();
 			// send keep-alive msg in every 20s
-			CreateKeepaliveThread();
+			StartKeepalive();
+		} else if (transaction == "Claim") {
+			if (janus == "success") {
+				StartKeepalive();
+				LogRecovery("session claimed");
+				// `Publish()` called while we were away
+				if (publishing_ &&
+				    state_ == JanusState::kHandle)
+					Publish(nullptr, id_, display_.c_str(),
+						room_, pin_.c_str());
+			} else {
+				OnSessionLost();
+			}
 		} else if (transaction == "Attach" && janus == "success") {
-			uint64_t hdl_id = json["data"]["id"];
+			uint64_t hdl_id;
+			if (!DataId(json, hdl_id))
+				return;
 			handle_id_ = hdl_id;
-			// publish media stream automatically
-			Publish(nullptr, id_, display_.c_str(), room_,
-				pin_.c_str());
-		} else if (transaction == "JoinRoom" && janus == "event") {
-			// joined the room
-			CreateRTCClient();
-			CreateOffer();
-			// set join room state to `true`
-			joined_room_ = true;
+			AdvanceState(JanusState::kSession, JanusState::kHandle,
+				     "attached");
+			MarkPhase(PublishPhase::kHandleAttached);
+			if (publishing_) {
+				// publish media stream automatically
+				Publish(nullptr, id_, display_.c_str(), room_,
+					pin_.c_str());
+			} else {
+				blog(LOG_INFO, "janus handle %llu is warm",
+				     (unsigned long long)hdl_id);
+			}
+		} else if (transaction == "JoinAndConfigure" &&
+			   janus == "event") {
+			std::string sdp;
+			if (JsepSdp(json, sdp)) {
+				// joined the room & published in one go
+				AdvanceState(JanusState::kHandle,
+					     JanusState::kJoined, "joined");
+				MarkPhase(PublishPhase::kRoomJoined);
+				SetAnswer(sdp);
+				LogRecovery("re-joined");
+			} else {
+				// e.g. a wrong pin or no such room
+				std::string error = "joinandconfigure rejected";
+				auto plugindata = json.find("plugindata");
+				if (plugindata != json.end() &&
+				    plugindata->is_object()) {
+					auto data = plugindata->find("data");
+					if (data != plugindata->end() &&
+					    data->is_object())
+						StringField(*data, "error",
+							    error);
+				}
+				FailPublish(error);
+			}
 		} else if (transaction == "Configure" && janus == "event") {
-			// process configs & set remote offer
-			std::string sdp = json["jsep"]["sdp"];
-			SetAnswer(sdp);
-		}
-	} else if (json.contains("janus")) {
-		std::string janus = json["janus"];
-		if (janus == "hangup") {
-			// hangup from janus
+			std::string sdp;
+			if (JsepSdp(json, sdp)) {
+				// process configs & set remote offer
+				SetAnswer(sdp);
+				LogRecovery("re-joined");
+			} else {
+				// the ice restart is tried again by its backoff
+				blog(LOG_WARNING, "configure failed: %s",
+				     json.value("plugindata", nlohmann::json())
+					     .dump()
+					     .c_str());
+			}
 		}
+	} else {
+		// events of another handle, e.g. a previous publish
+		if (json.contains("sender") &&
+		    json["sender"] != handle_id_.load())
+			return;
+		OnJanusEvent(janus, json);
+	}
+}
+
+void JanusConnection::OnJanusEvent(const std::string &janus,
+				   const nlohmann::json &json)
+{
+	if (janus == "webrtcup") {
+		link_health_.OnWebrtcUp();
+	} else if (janus == "media") {
+		link_health_.OnMedia(json.value("type", ""),
+				     json.value("receiving", false));
+	} else if (janus == "slowlink") {
+		// janus < 1.0 reports "nacks" instead of "lost"
+		uint32_t lost = json.value("lost", json.value("nacks", 0u));
+		if (link_health_.OnSlowlink(json.value("uplink", false), lost))
+			worker_.Post([this]() { AdaptBitrate(true); });
+	} else if (janus == "hangup") {
+		// the peerconnection is closed on janus
+		link_health_.OnHangup(json.value("reason", ""));
 	}
 }
 
@@ -150,124 +702,424 @@ void JanusConnection::OnIceCandidateDiscoveried(std::string &id,
 		      candidate.sdp_mline_index);
 }
 
+void JanusConnection::OnSignalingState(std::string &id,
+				       libwebrtc::RTCSignalingState state)
+{
+}
+
+void JanusConnection::OnPeerConnectionState(
+	std::string &id, libwebrtc::RTCPeerConnectionState state)
+{
+	if (state == libwebrtc::RTCPeerConnectionStateConnected) {
+		MarkPhase(PublishPhase::kPeerConnected);
+		StartStatsPoller();
+	}
+}
+
+void JanusConnection::OnIceGatheringState(std::string &id,
+					  libwebrtc::RTCIceGatheringState state)
+{
+	if (state == libwebrtc::RTCIceGatheringStateComplete)
+		MarkPhase(PublishPhase::kIceGathered);
+}
+
+void JanusConnection::OnIceConnectionState(
+	std::string &id, libwebrtc::RTCIceConnectionState state)
+{
+	if (state == libwebrtc::RTCIceConnectionStateConnected ||
+	    state == libwebrtc::RTCIceConnectionStateCompleted) {
+		MarkPhase(PublishPhase::kIceConnected);
+
+		// cancel the pending restart
+		++ice_restart_generation_;
+		uint64_t ts = ice_disconnected_ts_.exchange(0);
+		if (ts != 0) {
+			blog(LOG_INFO, "media path recovered in %llu ms",
+			     (unsigned long long)((os_gettime_ns() - ts) /
+						  1000000));
+			worker_.Post([this]() { ice_restart_backoff_.Reset(); });
+		}
+
+		auto observer = observer_.Read();
+		if (observer)
+			observer->OnPathUp(this);
+	} else if (state == libwebrtc::RTCIceConnectionStateDisconnected) {
+		// often recovers by itself, e.g. a wifi roam
+		uint64_t expected = 0;
+		if (ice_disconnected_ts_.compare_exchange_strong(
+			    expected, os_gettime_ns())) {
+			blog(LOG_WARNING, "ice disconnected");
+			ScheduleIceRestart(2000);
+		}
+	} else if (state == libwebrtc::RTCIceConnectionStateFailed) {
+		uint64_t expected = 0;
+		ice_disconnected_ts_.compare_exchange_strong(expected,
+							     os_gettime_ns());
+		blog(LOG_WARNING, "ice failed");
+		ScheduleIceRestart(0);
+		NotifyPathDown("ice failed");
+	}
+}
+
+void JanusConnection::ScheduleIceRestart(uint32_t delay_ms)
+{
+	uint32_t generation = ++ice_restart_generation_;
+	worker_.PostDelayed([this, generation]() { RestartIce(generation); },
+			    delay_ms);
+}
+
+void JanusConnection::RestartIce(uint32_t generation)
+{
+	if (generation != ice_restart_generation_ || !publishing_ ||
+	    closing_)
+		return;
+
+	if (ice_restart_backoff_.Exhausted()) {
+		blog(LOG_ERROR, "ice restart gave up after %u attempts",
+		     ice_restart_backoff_.Attempts());
+		ice_restart_backoff_.Reset();
+		FailPublish("ice lost");
+		return;
+	}
+
+	// the offer is sent by `OnLocalOffer()` once the room is joined
+	auto ws_client = Signaling();
+	bool signaling_up = ws_client != nullptr && ws_client->Connected() &&
+			    Joined();
+	if (signaling_up) {
+		uint32_t rtc_generation;
+		auto client = GetRTCClient(rtc_generation);
+		if (client == nullptr)
+			return;
+
+		blog(LOG_INFO, "restarting ice (attempt %u)",
+		     ice_restart_backoff_.Attempts() + 1);
+		// the offer may wait for the signaling thread, not on the pool
+		auto anchor = anchor_;
+		rtc_worker_.Post([client, anchor, rtc_generation]() {
+			client->CreateOffer(
+				new CallbackContext{anchor, rtc_generation},
+				OnOfferCreated, true);
+		});
+	}
+
+	// try again if it does not connect, or once the signaling is back
+	uint32_t delay = ice_restart_backoff_.NextDelay();
+	worker_.PostDelayed([this, generation]() { RestartIce(generation); },
+			    delay);
+}
+
+void JanusConnection::OnRenegotiationNeeded(std::string &id) {}
+
+void JanusConnection::MarkPhase(PublishPhase phase)
+{
+	if (!timeline_.Mark(phase))
+		return;
+
+	blog(LOG_DEBUG, "publish phase %s reached in %lld ms",
+	     PublishTimeline::PhaseName(phase),
+	     (long long)timeline_.Elapsed(phase));
+
+	if (phase == PublishPhase::kFirstFrame) {
+		blog(LOG_INFO, "publish timeline: %s",
+		     timeline_.Summary().c_str());
+	}
+}
+
+std::string JanusConnection::GetPublishTimeline() const
+{
+	return timeline_.ToJson();
+}
+
+void JanusConnection::Prewarm(const char *url)
+{
+	prewarm_ = true;
+
+	// neither connected nor trying to, e.g. unpublished after the server
+	// went away
+	auto ws_client = Signaling();
+	bool gone = ws_client != nullptr && !ws_client->Connected() &&
+		    !connecting_ && disconnected_ts_ == 0;
+	if (ws_client != nullptr && !publishing_ &&
+	    ((url != nullptr && url_ != url) || gone)) {
+		// the server changed, drop the old warm session
+		ResetSignaling();
+		ws_client = nullptr;
+	}
+
+	if (ws_client == nullptr) {
+		Connect(url);
+		blog(LOG_INFO, "pre-warming janus session on %s",
+		     url_.c_str());
+	}
+}
+
+void JanusConnection::ResetSignaling()
+{
+	StopKeepalive();
+	Disconnect();
+	session_id_ = 0;
+	handle_id_ = 0;
+	SetState(JanusState::kNone, "reset");
+	disconnected_ts_ = 0;
+	reconnect_backoff_.Reset();
+}
+
 void JanusConnection::Publish(const char *url, uint32_t id, const char *display,
 			      uint64_t room, const char *pin)
 {
+	// called again internally once the handle is ready
+	bool fresh = !publishing_;
+
 	id_ = id;
-	display_ = display;
+	display_ = display ? display : "";
 	room_ = room;
-	pin_ = pin;
+	pin_ = pin ? pin : "";
+	publishing_ = true;
+
+	if (url != nullptr && url_ != url && Signaling() != nullptr) {
+		// warm session on another server
+		ResetSignaling();
+	}
+
+	if (fresh) {
+		ResetStats();
+		timeline_.Start();
+		link_health_.Start();
+		StartAdaptation();
+		// done by pre-warming already
+		auto ws_client = Signaling();
+		if (ws_client != nullptr && ws_client->Connected())
+			MarkPhase(PublishPhase::kWebsocketConnected);
+		JanusState state = state_;
+		if (state >= JanusState::kSession)
+			MarkPhase(PublishPhase::kSessionCreated);
+		if (state >= JanusState::kHandle)
+			MarkPhase(PublishPhase::kHandleAttached);
+	}
+
+	// negotiate while the signaling is still being set up, the offer goes
+	// out together with the join request
+	if (GetRTCClient() == nullptr)
+		rtc_worker_.Post([this]() { Negotiate(); });
 
-	if (ws_client_ == nullptr || !ws_client_->Connected()) {
+	auto ws_client = Signaling();
+	if (ws_client == nullptr ||
+	    (!ws_client->Connected() && !connecting_ &&
+	     disconnected_ts_ == 0)) {
 		// make a connection first
 		Connect(url);
-	} else {
-		if (!joined_room_) {
-			nlohmann::json payload = {{"janus", "message"},
-						  {"transaction", "JoinRoom"},
-						  {"handle_id", handle_id_},
-						  {"session_id", session_id_},
-						  {"body",
-						   {{"request", "join"},
-						    {"ptype", "publisher"},
-						    {"room", room},
-						    {"pin", pin},
-						    {"display", display},
-						    {"id", id}}}};
-			std::string msg = payload.dump();
-			ws_client_->SendMsg(msg);
-		} else {
-			CreateRTCClient();
-			CreateOffer();
-		}
+	} else if (ws_client->Connected() && state_ == JanusState::kHandle) {
+		JoinAndConfigure();
+	}
+	// otherwise the room is joined once both the handle & the offer are
+	// ready, or the offer is sent by `OnLocalOffer()` if joined already
+}
+
+void JanusConnection::Negotiate()
+{
+	// e.g. unpublished meanwhile, or posted twice by the re-entry once the
+	// handle is attached
+	if (!publishing_ || closing_ || GetRTCClient() != nullptr)
+		return;
+
+	CreateRTCClient();
+	if (GetRTCClient() == nullptr) {
+		FailPublish("create rtc client failed");
+		return;
 	}
+	CreateOffer();
 }
 
 void JanusConnection::Unpublish()
 {
-	nlohmann::json payload = {{"janus", "message"},
-				  {"transaction", "Unpublish"},
-				  {"handle_id", handle_id_},
-				  {"session_id", session_id_},
-				  {"body", {{"request", "unpublish"}}}};
-	std::string msg = payload.dump();
-	ws_client_->SendMsg(msg);
+	publishing_ = false;
+	// a pending reconnect has nothing to recover anymore
+	disconnected_ts_ = 0;
+	reconnect_backoff_.Reset();
+	StopAdaptation();
+	link_health_.Stop();
 
-	// destory RTCClient
-	DestoryRTCClient();
-	// release the `VideoFrameFeeder`
-	if (video_feeder_) {
-		delete video_feeder_;
-		video_feeder_ = nullptr;
+	auto ws_client = Signaling();
+	if (ws_client != nullptr && ws_client->Connected()) {
+		nlohmann::json payload = {{"janus", "message"},
+					  {"transaction", "Unpublish"},
+					  {"handle_id", handle_id_.load()},
+					  {"session_id", session_id_.load()},
+					  {"body", {{"request", "unpublish"}}}};
+		std::string msg = payload.dump();
+		ws_client->SendMsg(msg, signaling::MessagePriority::kHigh);
 	}
+
+	// destory RTCClient & release the `VideoFrameFeeder` in the background,
+	// the output reports stopped right away
+	DestoryRTCClient();
 }
 
 void JanusConnection::CreateRTCClient()
 {
-	if (rtc_client_ != nullptr)
+	if (GetRTCClient() != nullptr)
 		return;
 
-	typedef std::unordered_map<std::string, std::string> ICEServer;
-	auto ice_servers = std::vector<ICEServer>{};
-	// default ice servers
+	rtc::RTCEncodingSettings encoding;
+	rtc::RTCIceSettings ice;
 	{
-		ICEServer map = {
-			{"uri", "stun:120.79.19.54:3478"},
-			{"username", "amdox"},
-			{"passwd", "123456"},
-		};
-		ice_servers.push_back(map);
-	}
-	{
-		ICEServer map = {
-			{"uri", "turn:120.79.19.54:3478"},
-			{"username", "amdox"},
-			{"passwd", "123456"},
-		};
-		ice_servers.push_back(map);
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		encoding = AdaptedEncodingSettings();
+		ice = ice_settings_;
+		if (ice.servers.empty() && default_ice_servers_) {
+			// default ice servers
+			ice.servers.push_back({
+				{"uri", "stun:120.79.19.54:3478"},
+				{"username", "amdox"},
+				{"passwd", "123456"},
+			});
+			ice.servers.push_back({
+				{"uri", "turn:120.79.19.54:3478"},
+				{"username", "amdox"},
+				{"passwd", "123456"},
+			});
+		}
 	}
 	std::string id("obs");
-	rtc_client_ = rtc::CreateClient(ice_servers, id);
+	// may wait for the peerconnection factory
+	auto client = rtc::CreateClient(ice, id, factory_config_, encoding);
+	if (client == nullptr)
+		return;
+	client->AddPeerconnectionEventsObserver(this);
+
+	// the feeder is the source of the client's video track, release it
+	// after the peerconnection, whichever thread drops the client last
+	auto feeder = new VideoFeederImpl();
+	std::lock_guard<std::mutex> lock(rtc_mutex_);
+	rtc_client_.reset(client, [feeder](rtc::RTCClient *released) {
+		PostTeardown([released, feeder]() {
+			released->Close();
+			delete released;
+			delete feeder;
+		});
+	});
+	video_feeder_ = feeder;
+}
+
+std::shared_ptr<rtc::RTCClient> JanusConnection::GetRTCClient() const
+{
+	std::lock_guard<std::mutex> lock(rtc_mutex_);
+	return rtc_client_;
 }
 
-rtc::RTCClient *JanusConnection::GetRTCClient() const
+std::shared_ptr<rtc::RTCClient>
+JanusConnection::GetRTCClient(uint32_t &generation) const
 {
+	std::lock_guard<std::mutex> lock(rtc_mutex_);
+	generation = rtc_generation_;
 	return rtc_client_;
 }
 
+std::shared_ptr<rtc::RTCClient> JanusConnection::ClientOf(uint32_t generation)
+{
+	// `DestoryRTCClient()` bumps the generation before it withdraws the
+	// sinks, so a stale client is not handed out
+	auto sinks = sinks_.Read();
+	if (!sinks || generation != rtc_generation_)
+		return nullptr;
+	return sinks->client;
+}
+
 void JanusConnection::SendVideoFrame(OBSVideoFrame *frame, int width,
 				     int height)
 {
-	if (video_feeder_ == nullptr)
+	// lock-free, `DestoryRTCClient()` waits for the frame being fed
+	auto sinks = sinks_.Read();
+	if (!sinks)
 		return;
-	video_feeder_->FeedVideoFrame(frame, width, height);
+	sinks->feeder->FeedVideoFrame(frame, width, height);
+	// frames before the peerconnection is up are dropped by webrtc
+	if (timeline_.Reached(PublishPhase::kPeerConnected))
+		MarkPhase(PublishPhase::kFirstFrame);
 }
 
 void JanusConnection::SendVideoPacket(OBSVideoPacket *pkt, int width,
 				      int height)
 {
-	if (video_feeder_ == nullptr)
+	auto sinks = sinks_.Read();
+	if (!sinks)
+		return;
+	sinks->feeder->FeedVideoPacket(pkt, width, height);
+	if (timeline_.Reached(PublishPhase::kPeerConnected))
+		MarkPhase(PublishPhase::kFirstFrame);
+}
+
+void JanusConnection::SendVideoFrame(const RTCVideoFrameRef &frame)
+{
+	auto sinks = sinks_.Read();
+	if (!sinks)
 		return;
-	video_feeder_->FeedVideoPacket(pkt, width, height);
+	sinks->feeder->FeedVideoFrame(frame);
+	if (timeline_.Reached(PublishPhase::kPeerConnected))
+		MarkPhase(PublishPhase::kFirstFrame);
+}
+
+void JanusConnection::SendVideoPacket(const RTCVideoFrameRef &packet)
+{
+	auto sinks = sinks_.Read();
+	if (!sinks)
+		return;
+	sinks->feeder->FeedVideoPacket(packet);
+	if (timeline_.Reached(PublishPhase::kPeerConnected))
+		MarkPhase(PublishPhase::kFirstFrame);
 }
 
 void JanusConnection::SendAudioFrame(OBSAudioFrame *frame)
 {
-	if (rtc_client_ == nullptr) {
+	auto sinks = sinks_.Read();
+	if (!sinks)
 		return;
-	}
-	rtc_client_->SendAudioData(frame->data[0], frame->timestamp,
-				   frame->frames, sample_rate_, channels_);
+	sinks->client->SendAudioData(frame->data[0], frame->timestamp,
+				     frame->frames, sample_rate_, channels_);
 }
 
 void JanusConnection::DestoryRTCClient()
 {
-	if (rtc_client_ == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(offer_mutex_);
+		pending_offer_.clear();
+	}
+
+	StopStatsPoller();
+	// the peerconnection is gone, nothing to restart
+	++ice_restart_generation_;
+	ice_disconnected_ts_ = 0;
+
+	std::shared_ptr<rtc::RTCClient> client;
+	{
+		std::lock_guard<std::mutex> lock(rtc_mutex_);
+		// the pending callbacks of the client are stale from here
+		++rtc_generation_;
+		// the obs threads stop feeding here, waits for the frame in
+		// flight
+		delete sinks_.Exchange(nullptr);
+		client.swap(rtc_client_);
+		// the next client gets a new feeder, the closing one may still
+		// touch this one
+		video_feeder_ = nullptr;
+	}
+	if (client == nullptr)
 		return;
 
-	rtc_client_->Close();
-	delete rtc_client_;
-	rtc_client_ = nullptr;
+	// the callbacks may outlive us while the client closes
+	client->AddPeerconnectionEventsObserver(nullptr);
+	client->AddIceCandidateObserver(nullptr);
+
+	{
+		// a new peerconnection counts from 0 again
+		std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+		bytes_base_ += stats_.bytes_sent;
+		dropped_base_ += stats_.frames_dropped;
+		stats_ = rtc::RTCSenderStats();
+	}
+	// closed on the teardown queue by the last one holding it, see
+	// `CreateRTCClient()`
 }
 
 void JanusConnection::CreateSession()
@@ -275,7 +1127,7 @@ void JanusConnection::CreateSession()
 	nlohmann::json payload = {{"janus", "create"},
 				  {"transaction", "Create"}};
 	std::string create_msg = payload.dump();
-	ws_client_->SendMsg(create_msg);
+	SendMsg(create_msg);
 }
 
 void JanusConnection::CreateHandle()
@@ -283,40 +1135,124 @@ void JanusConnection::CreateHandle()
 	nlohmann::json payload = {{"janus", "attach"},
 				  {"transaction", "Attach"},
 				  {"plugin", "janus.plugin.videoroom"},
-				  {"session_id", session_id_}};
+				  {"session_id", session_id_.load()}};
 	std::string msg = payload.dump();
-	ws_client_->SendMsg(msg);
+	SendMsg(msg);
 }
 
 void JanusConnection::CreateOffer()
 {
-	// create video framer if necessary
-	if (video_feeder_ == nullptr) {
-		video_feeder_ = new VideoFeederImpl();
+	std::shared_ptr<rtc::RTCClient> client;
+	VideoFeederImpl *feeder;
+	uint32_t generation;
+	{
+		std::lock_guard<std::mutex> lock(rtc_mutex_);
+		client = rtc_client_;
+		feeder = video_feeder_;
+		generation = rtc_generation_;
 	}
-
-	if (rtc_client_ == nullptr)
+	if (client == nullptr)
 		return;
 
 	// create media sender
 	if (use_encoded_data_) {
-		rtc_client_->CreateMediaSender(video_feeder_, true);
+		client->CreateMediaSender(feeder, true);
 	} else {
-		rtc_client_->CreateMediaSender(video_feeder_);
+		client->CreateMediaSender(feeder);
+	}
+
+	{
+		// the obs threads feed the sender from here on, unless the
+		// client was released meanwhile
+		std::lock_guard<std::mutex> lock(rtc_mutex_);
+		if (rtc_client_ != client)
+			return;
+		delete sinks_.Exchange(new MediaSinks{client, feeder});
 	}
 
 	// create offer
-	rtc_client_->CreateOffer(this, [](janus::rtc::RTCSessionDescription &sdp,
-					  std::string &error, void *params) {
-		auto self = reinterpret_cast<janus::JanusConnection *>(params);
-		if (self != nullptr && error.empty()) {
-			// set local sdp
-			self->GetRTCClient()->SetLocalDescription(
-				sdp.sdp.c_str(), sdp.type.c_str(), NULL, NULL);
-			// send to janus
-			self->SendOffer(sdp.sdp);
-		}
-	});
+	client->CreateOffer(new CallbackContext{anchor_, generation},
+			    OnOfferCreated);
+}
+
+void JanusConnection::OnOfferCreated(rtc::RTCSessionDescription &sdp,
+				     std::string &error, void *params)
+{
+	// on the signaling thread, `rtc_mutex_` may be held by a thread
+	// waiting for it
+	std::unique_ptr<CallbackContext> context(
+		reinterpret_cast<CallbackContext *>(params));
+	auto self = context->anchor->Read();
+	if (!self || !error.empty())
+		return;
+
+	// released while the offer was created
+	auto client = self->ClientOf(context->generation);
+	if (client != nullptr)
+		self->OnLocalOffer(sdp, client);
+}
+
+void JanusConnection::OnLocalOffer(
+	rtc::RTCSessionDescription &sdp,
+	const std::shared_ptr<rtc::RTCClient> &client)
+{
+	std::string offer;
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		offer = rtc::MungeLocalOffer(sdp.sdp, sdp_options_);
+	}
+	// set local sdp
+	client->SetLocalDescription(offer.c_str(), sdp.type.c_str(), NULL,
+				    NULL);
+	MarkPhase(PublishPhase::kOfferCreated);
+
+	if (Joined()) {
+		// already in the room, just publish
+		SendOffer(offer);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(offer_mutex_);
+		pending_offer_ = offer;
+	}
+	JoinAndConfigure();
+}
+
+void JanusConnection::JoinAndConfigure()
+{
+	// called from the websocket thread when the handle is attached & from
+	// the webrtc signaling thread when the offer is created, whoever comes
+	// last sends the request
+	std::string sdp;
+	{
+		std::lock_guard<std::mutex> lock(offer_mutex_);
+		auto ws_client = Signaling();
+		if (pending_offer_.empty() || state_ != JanusState::kHandle ||
+		    ws_client == nullptr || !ws_client->Connected())
+			return;
+		sdp.swap(pending_offer_);
+	}
+
+	nlohmann::json payload = {{"janus", "message"},
+				  {"transaction", "JoinAndConfigure"},
+				  {"handle_id", handle_id_.load()},
+				  {"session_id", session_id_.load()},
+				  {"body",
+				   {{"request", "joinandconfigure"},
+				    {"ptype", "publisher"},
+				    {"room", room_},
+				    {"pin", pin_},
+				    {"display", display_},
+				    {"id", id_},
+				    {"audio", true},
+				    {"video", true}}},
+				  {"jsep", {{"type", "offer"}, {"sdp", sdp}}}};
+	std::string codec = VideoCodecOfRoom();
+	if (!codec.empty())
+		payload["body"]["videocodec"] = codec;
+	std::string msg = payload.dump();
+	SendMsg(msg, signaling::MessagePriority::kHigh);
 }
 
 void JanusConnection::SendOffer(std::string &sdp)
@@ -324,82 +1260,333 @@ void JanusConnection::SendOffer(std::string &sdp)
 	nlohmann::json payload = {
 		{"janus", "message"},
 		{"transaction", "Configure"},
-		{"handle_id", handle_id_},
-		{"session_id", session_id_},
+		{"handle_id", handle_id_.load()},
+		{"session_id", session_id_.load()},
 		{"body",
 		 {{"request", "configure"}, {"audio", true}, {"video", true}}},
 		{"jsep", {{"type", "offer"}, {"sdp", sdp}}}};
+	std::string codec = VideoCodecOfRoom();
+	if (!codec.empty())
+		payload["body"]["videocodec"] = codec;
 	std::string msg = payload.dump();
-	ws_client_->SendMsg(msg);
+	SendMsg(msg, signaling::MessagePriority::kHigh);
 }
 
 void JanusConnection::SendCandidate(std::string &sdp, std::string &mid, int idx)
 {
 	nlohmann::json payload = {{"janus", "trickle"},
 				  {"transaction", "Candidate"},
-				  {"handle_id", handle_id_},
-				  {"session_id", session_id_},
+				  {"handle_id", handle_id_.load()},
+				  {"session_id", session_id_.load()},
 				  {"candidate",
 				   {{"candidate", sdp},
 				    {"sdpMid", mid},
 				    {"sdpMLineIndex", idx}}}};
 	std::string msg = payload.dump();
-	ws_client_->SendMsg(msg);
+	SendMsg(msg, signaling::MessagePriority::kHigh, true);
 }
 
 void JanusConnection::SetAnswer(std::string &sdp)
 {
-	if (rtc_client_ == nullptr)
+	uint32_t generation;
+	auto client = GetRTCClient(generation);
+	if (client == nullptr)
+		return;
+
+	rtc::SdpMungeOptions options;
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		options = sdp_options_;
+		options.start_bitrate = encoding_settings_.start_bitrate;
+	}
+	std::string answer = rtc::MungeRemoteAnswer(sdp, options);
+	// waits for the signaling thread, not on the io thread
+	auto anchor = anchor_;
+	rtc_worker_.Post([client, anchor, generation, answer]() {
+		client->SetRemoteDescription(
+			answer.c_str(), "answer",
+			new CallbackContext{anchor, generation}, OnAnswerSet);
+	});
+}
+
+void JanusConnection::OnAnswerSet(std::string &error, void *params)
+{
+	// like `OnOfferCreated()`, the client may be gone by now
+	std::unique_ptr<CallbackContext> context(
+		reinterpret_cast<CallbackContext *>(params));
+	auto self = context->anchor->Read();
+	if (!self || !error.empty())
 		return;
 
-	rtc_client_->SetRemoteDescription(sdp.c_str(), "answer", NULL, NULL);
+	// the sender's encodings exist once negotiated
+	auto client = self->ClientOf(context->generation);
+	if (client != nullptr)
+		client->ApplyEncodingSettings();
 }
 
-static void KeepAlive(uint64_t session, signaling::WebsocketClient *client)
+void JanusConnection::StartKeepalive()
 {
+	uint32_t generation = ++keepalive_generation_;
+	worker_.Post([this, generation]() { SendKeepalive(generation); });
+}
+
+void JanusConnection::StopKeepalive()
+{
+	// the pending keep-alive task sees a stale generation and quits
+	++keepalive_generation_;
+}
+
+void JanusConnection::SendKeepalive(uint32_t generation)
+{
+	auto ws_client = Signaling();
+	if (generation != keepalive_generation_ || session_id_ == 0 ||
+	    ws_client == nullptr)
+		return;
+
 	nlohmann::json payload = {{"janus", "keepalive"},
 				  {"transaction", "Keepalive"},
-				  {"session_id", session}};
+				  {"session_id", session_id_.load()}};
 	std::string msg = payload.dump();
+	ws_client->SendMsg(msg, signaling::MessagePriority::kNormal, true);
+
+	worker_.PostDelayed([this, generation]() { SendKeepalive(generation); },
+			    20 * 1000);
+}
+
+void JanusConnection::StartStatsPoller()
+{
+	uint32_t generation = ++stats_generation_;
+	stats_pending_ = false;
+	worker_.Post([this, generation]() { PollStats(generation); });
+}
 
-	client->SendMsg(msg);
+void JanusConnection::StopStatsPoller()
+{
+	++stats_generation_;
 }
 
-static void *StartSendingKeepalive(void *params)
+void JanusConnection::PollStats(uint32_t generation)
 {
-	auto list = static_cast<std::list<void *> *>(params);
-	auto ws_client =
-		static_cast<signaling::WebsocketClient *>(list->front());
-	auto session = static_cast<uint64_t *>(list->back());
+	if (generation != stats_generation_)
+		return;
 
-	// set thread name
-	os_set_thread_name("janus-keep-alive");
+	auto client = GetRTCClient();
+	if (client == nullptr)
+		return;
 
-	while (*session > 0) {
-		KeepAlive(*session, ws_client);
-		Sleep(20 * 1000);
+	// collected on the signaling thread, the request is not waited for,
+	// skipped while the previous one is still being collected
+	if (!stats_pending_.exchange(true)) {
+		auto anchor = anchor_;
+		rtc_worker_.Post([client, anchor, generation]() {
+			auto context = new CallbackContext{anchor, generation};
+			client->GetStats(context, OnStatsCollected);
+		});
 	}
 
-	// this list created on the heap
-	delete list;
-	list = nullptr;
+	worker_.PostDelayed([this, generation]() { PollStats(generation); },
+			    1000);
+}
+
+void JanusConnection::OnStatsCollected(rtc::RTCSenderStats &stats,
+				       std::string &json, std::string &error,
+				       void *params)
+{
+	// like `OnOfferCreated()`, the connection may be gone by now
+	std::unique_ptr<CallbackContext> context(
+		reinterpret_cast<CallbackContext *>(params));
+	auto self = context->anchor->Read();
+	if (!self)
+		return;
+
+	// `DestoryRTCClient()` stops the poller before it takes the counters
+	// of the client, a stale result must not overwrite them
+	std::lock_guard<std::mutex> lock(self->stats_mutex_);
+	if (context->generation != self->stats_generation_)
+		return;
+	self->stats_pending_ = false;
+	if (!error.empty())
+		return;
 
-	return NULL;
+	// polled every second
+	if (stats.bytes_sent >= self->stats_.bytes_sent)
+		self->send_kbps_ = (uint32_t)((stats.bytes_sent -
+					       self->stats_.bytes_sent) *
+					      8 / 1000);
+	self->stats_ = stats;
+	self->stats_json_.swap(json);
 }
 
-int JanusConnection::CreateKeepaliveThread()
+void JanusConnection::StartAdaptation()
 {
-	auto list = new std::list<void *>{ws_client_, &session_id_};
-	return pthread_create(&keeplive_thread_, NULL, StartSendingKeepalive,
-			      list);
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		bitrate_factor_ = 1.0;
+		adapt_base_kbps_ = 0;
+	}
+	uint32_t generation = ++adapt_generation_;
+	worker_.PostDelayed(
+		[this, generation]() { CheckLinkHealth(generation); },
+		LinkHealth::kSlowlinkHoldMs);
 }
 
-void JanusConnection::InvalidKeepaliveThread()
+void JanusConnection::StopAdaptation()
 {
-	// deal with the keep-alive thread & stop the loop
-	session_id_ = 0;
-	handle_id_ = 0;
-	pthread_join(keeplive_thread_, NULL);
+	++adapt_generation_;
+}
+
+void JanusConnection::CheckLinkHealth(uint32_t generation)
+{
+	if (generation != adapt_generation_)
+		return;
+
+	link_health_.CheckRecovered();
+	// probe back up slowly, one step per quiet period
+	if (!link_health_.SlowlinkWithin(2 * LinkHealth::kSlowlinkHoldMs))
+		AdaptBitrate(false);
+
+	worker_.PostDelayed(
+		[this, generation]() { CheckLinkHealth(generation); },
+		LinkHealth::kSlowlinkHoldMs);
+}
+
+void JanusConnection::AdaptBitrate(bool down)
+{
+	double factor;
+	uint32_t max_bitrate;
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		factor = down ? std::max(bitrate_factor_ * 0.7, 0.25)
+			      : std::min(bitrate_factor_ * 1.15, 1.0);
+		if (factor == bitrate_factor_)
+			return;
+
+		if (adapt_base_kbps_ == 0 &&
+		    encoding_settings_.max_bitrate == 0) {
+			// no limit set, start from what goes out now
+			uint32_t kbps = send_kbps_;
+			adapt_base_kbps_ = kbps > 0 ? kbps : 2500;
+		}
+		bitrate_factor_ = factor;
+		max_bitrate = AdaptedEncodingSettings().max_bitrate;
+	}
+
+	blog(LOG_INFO, "slowlink adaptation: bitrate x%.2f, max %u kbps",
+	     factor, max_bitrate);
+	// setting the parameters waits for the signaling thread, not on the
+	// pool
+	rtc_worker_.Post([this]() { ApplyEncodingSettings(); });
+}
+
+void JanusConnection::ApplyEncodingSettings()
+{
+	std::lock_guard<std::mutex> apply_lock(apply_mutex_);
+	auto client = GetRTCClient();
+	if (client == nullptr)
+		return;
+
+	rtc::RTCEncodingSettings settings;
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		settings = AdaptedEncodingSettings();
+	}
+	client->SetEncodingSettings(settings);
+}
+
+rtc::RTCEncodingSettings JanusConnection::AdaptedEncodingSettings() const
+{
+	rtc::RTCEncodingSettings settings = encoding_settings_;
+	if (bitrate_factor_ >= 1.0)
+		return settings;
+
+	uint32_t base = settings.max_bitrate > 0 ? settings.max_bitrate
+						 : adapt_base_kbps_;
+	settings.max_bitrate =
+		std::max((uint32_t)(base * bitrate_factor_), 150u);
+	settings.min_bitrate =
+		std::min(settings.min_bitrate, settings.max_bitrate);
+	// webrtc drops the upper simulcast layers by itself, only cap them,
+	// a layer without a bitrate of its own goes at the sender's
+	for (auto &layer : settings.simulcast_layers) {
+		uint32_t kbps = layer.max_bitrate > 0 ? layer.max_bitrate
+						      : base;
+		layer.max_bitrate = (uint32_t)(kbps * bitrate_factor_);
+	}
+	// lower the resolution too once the bitrate is halved, unless it is
+	// meant to be kept
+	if (bitrate_factor_ <= 0.5 && settings.simulcast_layers.empty() &&
+	    settings.degradation != rtc::RTCDegradation::kMaintainResolution)
+		settings.scale_down = std::max(settings.scale_down, 1.0) * 1.5;
+	return settings;
+}
+
+std::string JanusConnection::GetLinkHealth()
+{
+	auto json = nlohmann::json::parse(link_health_.ToJson());
+	{
+		std::lock_guard<std::mutex> lock(settings_mutex_);
+		json["bitrate_factor"] = bitrate_factor_;
+	}
+	json["send_kbps"] = send_kbps_.load();
+	{
+		// what the protection costs & what is lost anyway
+		std::lock_guard<std::mutex> lock(stats_mutex_);
+		json["loss"] = {
+			{"packets_sent", stats_.packets_sent},
+			{"packets_lost", stats_.packets_lost},
+			{"fraction_lost", stats_.fraction_lost},
+			{"nacks", stats_.nack_count},
+			{"retransmitted_packets",
+			 stats_.retransmitted_packets_sent},
+			{"retransmitted_bytes", stats_.retransmitted_bytes_sent},
+		};
+	}
+	return json.dump();
+}
+
+void JanusConnection::ResetStats()
+{
+	std::lock_guard<std::mutex> lock(stats_mutex_);
+	stats_ = rtc::RTCSenderStats();
+	stats_json_.clear();
+	bytes_base_ = 0;
+	dropped_base_ = 0;
+}
+
+uint64_t JanusConnection::GetTotalBytes()
+{
+	std::lock_guard<std::mutex> lock(stats_mutex_);
+	return bytes_base_ + stats_.bytes_sent;
+}
+
+uint32_t JanusConnection::GetDroppedFrames()
+{
+	std::lock_guard<std::mutex> lock(stats_mutex_);
+	return dropped_base_ + stats_.frames_dropped;
+}
+
+std::string JanusConnection::GetStatsJson()
+{
+	std::lock_guard<std::mutex> lock(stats_mutex_);
+	nlohmann::json json = {
+		{"bytes_sent", bytes_base_ + stats_.bytes_sent},
+		{"packets_sent", stats_.packets_sent},
+		{"packets_lost", stats_.packets_lost},
+		{"rtt_ms", stats_.rtt_ms},
+		{"frames_captured", stats_.frames_captured},
+		{"frames_encoded", stats_.frames_encoded},
+		{"frames_dropped", dropped_base_ + stats_.frames_dropped},
+		{"total_encode_time", stats_.total_encode_time},
+		{"frames_per_second", stats_.frames_per_second},
+		{"frame_width", stats_.frame_width},
+		{"frame_height", stats_.frame_height},
+		{"quality_limitation_reason",
+		 stats_.quality_limitation_reason},
+		{"reports", nlohmann::json::parse(stats_json_.empty()
+							  ? "[]"
+							  : stats_json_,
+						  nullptr, false)}};
+	return json.dump();
 }
 
 }
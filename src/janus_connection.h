@@ -4,8 +4,15 @@
 #include "websocket_client.h"
 ////////////////////////////////////////////////////////////////////////
 #include "rtc_client.h"
+#include "sdp_munger.h"
+#include "task_queue.h"
+#include "backoff.h"
+#include "publish_timeline.h"
+#include "link_health.h"
+#include "epoch_ptr.h"
 #include "framegeneratorinterface.h"
 #include "videoencoderinterface.h"
+#include "nlohmann/json.hpp"
 
 #include <util/platform.h>
 #include <util/threading.h>
@@ -33,24 +40,67 @@ public:
 		owt::base::VideoFrameReceiverInterface *receiver) override;
 	// call this function from obs
 	void FeedVideoFrame(OBSVideoFrame *frame, int width, int height);
+	void FeedVideoFrame(const RTCVideoFrameRef &frame);
 
 	// encoded packet
 	virtual void SetBufferReceiver(
 		owt::base::VideoPacketReceiverInterface *receiver) override;
 	// call this function from obs
 	void FeedVideoPacket(OBSVideoPacket *pkt, int width, int height);
+	void FeedVideoPacket(const RTCVideoFrameRef &packet);
+
+	// copy the obs data into a webrtc frame once, it can be fed to the
+	// feeders of several connections
+	static RTCVideoFrameRef WrapFrame(OBSVideoFrame *frame, int width,
+					  int height);
+	static RTCVideoFrameRef WrapPacket(OBSVideoPacket *pkt, int width,
+					   int height);
 
 private:
 	owt::base::VideoFrameReceiverInterface *frame_receiver_;
 	owt::base::VideoPacketReceiverInterface *packet_receiver_;
 };
 
+// how far the janus side of a connection got, outlives a websocket
+// reconnect as long as the session can be claimed
+enum class JanusState {
+	kNone = 0, // no session
+	kSession,  // session created or claimed
+	kHandle,   // videoroom handle attached
+	kJoined,   // joined the room as a publisher
+	kCount,
+};
+
+class JanusConnection;
+
+// the owner of a connection, called from the websocket & webrtc threads,
+// must not block
+class JanusConnectionObserver {
+public:
+	// the signaling connection closed or the ice connection failed while
+	// publishing, the connection keeps trying to recover by itself
+	virtual void OnPathDown(JanusConnection *conn,
+				const std::string &reason) = 0;
+	// the ice connection of a publish is up
+	virtual void OnPathUp(JanusConnection *conn) = 0;
+	// janus rejected the publish, the connection gave it up
+	virtual void OnPublishFailed(JanusConnection *conn,
+				     const std::string &reason) = 0;
+};
+
 class JanusConnection : public signaling::WebsocketClientInterface,
-			public rtc::RTCClientIceCandidateObserver {
+			public rtc::RTCClientIceCandidateObserver,
+			public rtc::RTCClientConnectionObserver {
 public:
 	JanusConnection(bool send_encoded_data);
 	~JanusConnection();
 
+	// delete `conn` on the teardown queue, the caller returns right away
+	static void Destroy(JanusConnection *conn);
+	// block until everything handed to the teardown queue is released,
+	// before the signaling & the peerconnection factory shut down
+	static void WaitForTeardown();
+
 	// websocket event callbacks
 	virtual void OnConnected() override;
 	virtual void OnConnectionClosed(const std::string &reason) override;
@@ -60,58 +110,309 @@ public:
 	virtual void
 	OnIceCandidateDiscoveried(std::string &id,
 				  rtc::RTCIceCandidate &candidate) override;
+	virtual void OnSignalingState(std::string &id,
+				      libwebrtc::RTCSignalingState state) override;
+	virtual void
+	OnPeerConnectionState(std::string &id,
+			      libwebrtc::RTCPeerConnectionState state) override;
+	virtual void
+	OnIceGatheringState(std::string &id,
+			    libwebrtc::RTCIceGatheringState state) override;
+	virtual void
+	OnIceConnectionState(std::string &id,
+			     libwebrtc::RTCIceConnectionState state) override;
+	virtual void OnRenegotiationNeeded(std::string &id) override;
+
+	// blocks until the callbacks in flight have returned when replaced,
+	// nullptr to stop them
+	void SetObserver(JanusConnectionObserver *observer);
 
 	// janus conncetion events
+	// connect, create the session & attach the videoroom handle ahead of
+	// `Publish()`, kept alive until the connection is destroyed, starts
+	// over if the server changed or the previous connection is gone
+	void Prewarm(const char *url);
 	void Publish(const char *url, uint32_t id, const char *display,
 		     uint64_t room, const char *pin);
 	void Unpublish();
+	// false once unpublished or rejected by janus
+	bool Publishing() const;
 	void SendOffer(std::string &sdp);
+	// used by wss:// connections
+	void SetTlsOptions(const signaling::TlsOptions &options);
+	// negotiate permessage-deflate with janus, with the level & context
+	// takeover of `options`
+	void SetSignalingCompression(bool enabled,
+				     const signaling::DeflateOptions &options);
+	// takes effect on the next `Publish()`
+	void SetFactoryConfig(const rtc::RTCFactoryConfig &config);
+	// takes effect on the next `Publish()`, the default servers are used if
+	// `ice.servers` is empty & `use_default_servers` is set
+	void SetIceSettings(const rtc::RTCIceSettings &ice,
+			    bool use_default_servers);
+	// applied to the live peerconnection right away, the simulcast layers,
+	// scalability mode & codec are kept, see `SetSimulcastLayers()` &
+	// `SetVideoCodec()`
+	void SetEncodingSettings(const rtc::RTCEncodingSettings &settings);
+	// the number of layers takes effect on the next `Publish()`, their
+	// bitrate & scale right away
+	void SetSimulcastLayers(const std::vector<rtc::RTCSimulcastLayer> &layers);
+	// the preferred codec & svc mode of the raw video, the codec takes
+	// effect on the next `Publish()`
+	void SetVideoCodec(const std::string &codec,
+			   const std::string &scalability_mode);
+	// rewrites of the offer & answer, the codecs take effect on the next
+	// offer, the bandwidth on the next answer
+	// keeps the loss resilience set by `SetLossResilience()`
+	void SetSdpOptions(const rtc::SdpMungeOptions &options);
+	// nack, fec & red, negotiated with the next offer
+	void SetLossResilience(bool nack, bool ulpfec, bool flexfec,
+			       bool audio_red, bool opus_fec);
 
-	rtc::RTCClient *GetRTCClient() const;
+	std::shared_ptr<rtc::RTCClient> GetRTCClient() const;
+	// time-to-first-frame breakdown of the last `Publish()`, as json
+	std::string GetPublishTimeline() const;
+	// bytes sent & frames dropped since `Publish()`
+	uint64_t GetTotalBytes();
+	uint32_t GetDroppedFrames();
+	// the last webrtc stats snapshot, as json
+	std::string GetStatsJson();
+	// the media path as reported by janus & the current bitrate step, as
+	// json
+	std::string GetLinkHealth();
 
 	// called from obs output
 	void SendVideoFrame(OBSVideoFrame *frame, int width, int height);
 	void SendVideoPacket(OBSVideoPacket *pkt, int width, int height);
 	void SendAudioFrame(OBSAudioFrame *frame);
+	// a frame wrapped by `VideoFeederImpl`, shared with other connections
+	void SendVideoFrame(const RTCVideoFrameRef &frame);
+	void SendVideoPacket(const RTCVideoFrameRef &packet);
 
 private:
 	bool use_encoded_data_;
+	// keep-alive, reconnect & other delayed work, on a queue shared with
+	// the other connections
+	TaskRunner worker_;
+	// the calls into libwebrtc which may wait for its threads, e.g. the
+	// peerconnection & its offers, the answer & the slowlink encoding
+	// changes, off the pool & the io threads
+	TaskRunner rtc_worker_;
+	std::string url_;
 	uint32_t id_;
 	uint64_t room_;
 	std::string display_;
 	std::string pin_;
-	uint64_t session_id_;
-	uint64_t handle_id_;
-	bool joined_room_;
+	signaling::TlsOptions tls_options_;
+	bool signaling_compression_;
+	signaling::DeflateOptions deflate_options_;
+	rtc::RTCFactoryConfig factory_config_;
+	// guards the settings below & the slowlink adaptation, never held
+	// while calling into libwebrtc
+	mutable std::mutex settings_mutex_;
+	rtc::RTCEncodingSettings encoding_settings_;
+	rtc::RTCIceSettings ice_settings_;
+	rtc::SdpMungeOptions sdp_options_;
+	bool default_ice_servers_;
+	// one application of the encoding settings at a time, so the latest
+	// wins, held across libwebrtc calls & never taken on its threads
+	std::mutex apply_mutex_;
+
+	// written by the websocket, worker, webrtc & obs threads, the state
+	// only moves through `SetState()`
+	std::atomic<JanusState> state_;
+	std::atomic<uint64_t> session_id_;
+	std::atomic<uint64_t> handle_id_;
+	// `Publish()` called & not unpublished yet
+	std::atomic<bool> publishing_;
+	// keep a session & handle ready while not publishing
+	std::atomic<bool> prewarm_;
+	// waiting for the websocket to open
+	std::atomic<bool> connecting_;
+	// the websocket is being closed by ourselves, do not reconnect
+	std::atomic<bool> closing_;
+	// when the signaling connection dropped, 0 if it is up
+	std::atomic<uint64_t> disconnected_ts_;
+
+	EpochPtr<JanusConnectionObserver> observer_;
 
-	// send keep-alive to janus in this thread
-	pthread_t keeplive_thread_;
+	Backoff reconnect_backoff_;
+	// bumped to cancel the running keep-alive loop
+	std::atomic<uint32_t> keepalive_generation_;
 
-	signaling::WebsocketClient *ws_client_;
-	rtc::RTCClient *rtc_client_;
+	// ice restart after the media path broke
+	Backoff ice_restart_backoff_;
+	// bumped to cancel a scheduled ice restart
+	std::atomic<uint32_t> ice_restart_generation_;
+	// when the ice connection went down, 0 if it is up
+	std::atomic<uint64_t> ice_disconnected_ts_;
+
+	// when each phase of the current publish completed
+	PublishTimeline timeline_;
+
+	// driven by the janus events of our handle
+	LinkHealth link_health_;
+	// the max bitrate is scaled by this after slowlink, guarded by
+	// `settings_mutex_`
+	double bitrate_factor_;
+	// kbps the factor applies to when no max bitrate is set
+	uint32_t adapt_base_kbps_;
+	// bumped to cancel the running adaptation loop
+	std::atomic<uint32_t> adapt_generation_;
+	// measured by the stats poll
+	std::atomic<uint32_t> send_kbps_;
+
+	// bumped to cancel the running stats poll loop
+	std::atomic<uint32_t> stats_generation_;
+	// a stats request is in flight, one at a time
+	std::atomic<bool> stats_pending_;
+	std::mutex stats_mutex_;
+	rtc::RTCSenderStats stats_;
+	std::string stats_json_;
+	// counters of the previous peerconnections of this publish
+	uint64_t bytes_base_;
+	uint32_t dropped_base_;
+	// guards `rtc_client_` & `video_feeder_` only, the client is copied out
+	// & called without it, libwebrtc may call back on a thread waiting for
+	// it otherwise
+	mutable std::mutex rtc_mutex_;
+	// bumped when the client is released, its pending callbacks are stale
+	std::atomic<uint32_t> rtc_generation_;
+
+	// the local offer waiting for the handle to join the room with
+	std::mutex offer_mutex_;
+	std::string pending_offer_;
+
+	// replaced by the obs & worker threads while the io & worker threads
+	// use it, they take a copy with `Signaling()` & keep it alive
+	mutable std::mutex ws_mutex_;
+	std::shared_ptr<signaling::WebsocketClient> ws_client_;
+	// closed & released together with `video_feeder_` on the teardown
+	// queue once the last call in flight lets go of it
+	std::shared_ptr<rtc::RTCClient> rtc_client_;
 	VideoFeederImpl *video_feeder_;
 
+	// what the obs threads feed, published once the sender exists &
+	// withdrawn before the client & feeder are handed to the teardown,
+	// the libwebrtc callbacks take the client from here too
+	struct MediaSinks {
+		std::shared_ptr<rtc::RTCClient> client;
+		VideoFeederImpl *feeder;
+	};
+	EpochPtr<MediaSinks> sinks_;
+
+	// the libwebrtc callbacks find us through this, emptied by the
+	// destructor, which waits for the callback in flight
+	std::shared_ptr<EpochPtr<JanusConnection>> anchor_;
+	// the params of a libwebrtc callback, deleted by it, `generation` is
+	// the client's or the stats poll's
+	struct CallbackContext {
+		std::shared_ptr<EpochPtr<JanusConnection>> anchor;
+		uint32_t generation;
+	};
+	// the client of `generation` if still current, lock-free for the
+	// callbacks
+	std::shared_ptr<rtc::RTCClient> ClientOf(uint32_t generation);
+
 	// audio input params
 	size_t channels_;
 	uint32_t sample_rate_;
 
+	// `state_` transitions, logged
+	void SetState(JanusState state, const char *reason);
+	// moves to `to` only if still in `from`, e.g. a handle attached after
+	// the session was lost must not look joined
+	bool AdvanceState(JanusState from, JanusState to, const char *reason);
+	bool Joined() const;
+	static const char *StateName(JanusState state);
+
 	// websocket events
 	void Connect(const char *url);
 	void Disconnect();
+	std::shared_ptr<signaling::WebsocketClient> Signaling() const;
+	// queue `msg` on the current connection, false if there is none or
+	// the message was dropped
+	bool SendMsg(const std::string &msg,
+		     signaling::MessagePriority priority =
+			     signaling::MessagePriority::kNormal,
+		     bool droppable = false);
+	// drop the connection together with the session & handle
+	void ResetSignaling();
 
 	// RTCClient
 	void CreateRTCClient();
+	// the current client & the generation of its callbacks
+	std::shared_ptr<rtc::RTCClient>
+	GetRTCClient(uint32_t &generation) const;
+	// detach the client & its video feeder and release them on the
+	// teardown queue, closing a peerconnection blocks for a while
 	void DestoryRTCClient();
 
+	// run `task` on the process wide teardown queue, in the order posted,
+	// or right away if called from it
+	static void PostTeardown(TaskQueue::Task task);
+
 	// janus messages
 	void CreateSession();
 	void CreateHandle();
 
-	int CreateKeepaliveThread();
-	void InvalidKeepaliveThread();
+	// reclaim the previous session after reconnecting
+	void ClaimSession();
+	// the session expired on janus, start over with a new one
+	void OnSessionLost();
+
+	void StartKeepalive();
+	void StopKeepalive();
+	void SendKeepalive(uint32_t generation);
+
+	void ScheduleReconnect();
+	void LogRecovery(const char *how);
+	void NotifyPathDown(const std::string &reason);
+	// janus rejected the publish, give it up & tell the observer
+	void FailPublish(const std::string &reason);
 
 	void CreateOffer();
+	// create the peerconnection & its offer if `Publish()` has none, on
+	// `rtc_worker_`
+	void Negotiate();
+	// ice restart on the existing handle & peerconnection
+	void ScheduleIceRestart(uint32_t delay_ms);
+	void RestartIce(uint32_t generation);
+	static void OnOfferCreated(rtc::RTCSessionDescription &sdp,
+				   std::string &error, void *params);
+	void OnLocalOffer(rtc::RTCSessionDescription &sdp,
+			  const std::shared_ptr<rtc::RTCClient> &client);
+	// join the room & publish with the offer in a single request
+	void JoinAndConfigure();
 	void SendCandidate(std::string &sdp, std::string &mid, int idx);
+	// "videocodec" of the publish requests, empty for the room default
+	std::string VideoCodecOfRoom();
 	void SetAnswer(std::string &sdp);
+	static void OnAnswerSet(std::string &error, void *params);
+
+	void MarkPhase(PublishPhase phase);
+
+	void StartStatsPoller();
+	void StopStatsPoller();
+	void PollStats(uint32_t generation);
+	static void OnStatsCollected(rtc::RTCSenderStats &stats,
+				     std::string &json, std::string &error,
+				     void *params);
+	void ResetStats();
+
+	// a parsed message, throws if a field has an unexpected type
+	void OnJanusMessage(const nlohmann::json &json);
+	// asynchronous janus events of the publisher handle
+	void OnJanusEvent(const std::string &janus, const nlohmann::json &json);
+	void StartAdaptation();
+	void StopAdaptation();
+	void CheckLinkHealth(uint32_t generation);
+	// step the send bitrate down after slowlink or back up once it is gone
+	void AdaptBitrate(bool down);
+	// `encoding_settings_` with the slowlink adaptation applied, call with
+	// `settings_mutex_` held
+	rtc::RTCEncodingSettings AdaptedEncodingSettings() const;
+	// hand the adapted settings to the client, off the libwebrtc threads
+	void ApplyEncodingSettings();
 };
 }
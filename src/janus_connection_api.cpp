@@ -1,9 +1,46 @@
 #include "janus_connection.h"
+#include "janus_publisher.h"
+#include "media_hub.h"
+#include "deflate_extension.h"
+#include "tls_context.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#define blog(level, msg, ...) \
+	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+void InitializeRTCAsync()
+{
+	janus::rtc::InitializePeerConnectionFactoryAsync();
+}
+
+bool IsRTCAvailable()
+{
+	return janus::rtc::LoadRTCLibrary();
+}
+
+void TerminateRTC()
+{
+	// the released peerconnections still belong to the factory
+	janus::JanusConnection::WaitForTeardown();
+
+	auto stats = janus::MediaHub::Instance().GetStats();
+	if (stats.wrapped > 0)
+		blog(LOG_INFO,
+		     "video frames: %llu wrapped, %llu shared by the outputs",
+		     (unsigned long long)stats.wrapped,
+		     (unsigned long long)stats.shared);
+	// the cached frames as well
+	janus::MediaHub::Instance().Release();
+	janus::rtc::TerminatePeerConnectionFactory();
+}
+
 void *CreateConncetion(bool encoded)
 {
 	return new janus::JanusConnection(encoded);
@@ -11,11 +48,326 @@ void *CreateConncetion(bool encoded)
 
 void DestoryConnection(void *conn)
 {
+	// released in the background, see `WaitForTeardown()`
+	janus::JanusConnection::Destroy(
+		static_cast<janus::JanusConnection *>(conn));
+}
+
+void *CreatePublisher(bool encoded)
+{
+	return new janus::JanusPublisher(encoded);
+}
+
+void DestoryPublisher(void *publisher)
+{
+	// the connections are released in the background
+	delete static_cast<janus::JanusPublisher *>(publisher);
+}
+
+void SetPublisherDestinations(void *publisher, const char *destinations)
+{
+	std::vector<janus::JanusDestination> list;
+
+	// "url room [pin]" per line
+	std::istringstream lines(destinations ? destinations : "");
+	std::string line;
+	while (std::getline(lines, line)) {
+		std::istringstream fields(line);
+		janus::JanusDestination destination;
+		if (!(fields >> destination.url >> destination.room)) {
+			if (!destination.url.empty())
+				blog(LOG_WARNING, "invalid destination: %s",
+				     line.c_str());
+			continue;
+		}
+		fields >> destination.pin;
+		list.push_back(destination);
+	}
+
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	janus_pub->SetDestinations(list);
+}
+
+void SetPublisherFailover(void *publisher, const char *backup_urls,
+			  bool warm_standby)
+{
+	std::vector<std::string> urls;
+
+	std::istringstream lines(backup_urls ? backup_urls : "");
+	std::string line;
+	while (std::getline(lines, line)) {
+		std::istringstream fields(line);
+		std::string url;
+		if (fields >> url)
+			urls.push_back(url);
+	}
+
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	janus_pub->SetFailover(urls, warm_standby);
+}
+
+int GetPublisherConnectionCount(void *publisher)
+{
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	return (int)janus_pub->ConnectionCount();
+}
+
+void SetPublisherFailedCallback(void *publisher,
+				PublisherFailedCallback callback, void *param)
+{
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	janus_pub->SetFailedCallback(callback, param);
+}
+
+void *GetPublisherConnection(void *publisher, int index)
+{
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	if (index < 0)
+		return nullptr;
+	return janus_pub->Connection((size_t)index);
+}
+
+void SetSignalingThreadCount(int count)
+{
+	janus::signaling::IoContextPool::SetThreadCount(
+		count > 0 ? (size_t)count : 0);
+}
+
+void ShutdownSignaling()
+{
+	// the connections being released still close their websockets
+	janus::JanusConnection::WaitForTeardown();
+
+	auto stats = janus::signaling::DeflateExtension::Stats();
+	if (stats.raw_out > 0 || stats.raw_in > 0) {
+		blog(LOG_INFO,
+		     "signaling compression: sent %llu -> %llu bytes, "
+		     "received %llu -> %llu bytes",
+		     (unsigned long long)stats.raw_out,
+		     (unsigned long long)stats.compressed_out,
+		     (unsigned long long)stats.compressed_in,
+		     (unsigned long long)stats.raw_in);
+	}
+
+	janus::signaling::IoContextPool::Instance().Shutdown();
+	janus::TaskQueuePool::Instance().Shutdown();
+#ifdef JANUS_ENABLE_TLS
+	janus::signaling::ClearTlsCache();
+#endif
+}
+
+void SetTlsOptions(void *conn, bool verify_peer, const char *ca_file)
+{
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus::signaling::TlsOptions options;
+	options.verify_peer = verify_peer;
+	options.ca_file = ca_file ? ca_file : "";
+	janus_conn->SetTlsOptions(options);
+}
+
+void SetSignalingCompression(void *conn, bool enabled, int level,
+			     bool context_takeover)
+{
+	janus::signaling::DeflateOptions options;
+	if (level > 0)
+		options.level = level;
+	options.context_takeover = context_takeover;
+
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus_conn->SetSignalingCompression(enabled, options);
+}
+
+void SetRTCFactoryConfig(void *conn, bool hw_acceleration,
+			 bool customized_video_encoder)
+{
+	janus::rtc::RTCFactoryConfig config;
+	config.hardware_acceleration = hw_acceleration;
+	config.customized_video_encoder = customized_video_encoder;
+
 	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
-	if (janus_conn != nullptr) {
-		delete conn;
-		conn = nullptr;
+	janus_conn->SetFactoryConfig(config);
+}
+
+void SetIceOptions(void *conn, const char *servers,
+		   const char *transport_policy, bool low_cost_networks_only,
+		   bool disable_tcp, bool disable_ipv6, int candidate_pool_size)
+{
+	janus::rtc::RTCIceSettings ice;
+	std::string list = servers ? servers : "";
+	bool use_default_servers = list.empty();
+
+	// "uri [username password]" per line
+	std::istringstream lines(list);
+	std::string line;
+	while (std::getline(lines, line)) {
+		std::istringstream fields(line);
+		std::string uri, username, password;
+		if (!(fields >> uri) || uri == "none")
+			continue;
+		fields >> username >> password;
+		ice.servers.push_back({{"uri", uri},
+				       {"username", username},
+				       {"passwd", password}});
 	}
+
+	std::string policy = transport_policy ? transport_policy : "";
+	if (policy == "relay")
+		ice.transport_policy = janus::rtc::RTCIcePolicy::kRelay;
+	else if (policy == "nohost")
+		ice.transport_policy = janus::rtc::RTCIcePolicy::kNoHost;
+
+	ice.low_cost_networks_only = low_cost_networks_only;
+	ice.disable_tcp = disable_tcp;
+	ice.disable_ipv6 = disable_ipv6;
+	ice.candidate_pool_size = candidate_pool_size;
+
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus_conn->SetIceSettings(ice, use_default_servers);
+}
+
+void SetEncodingParameters(void *conn, uint32_t min_bitrate,
+			   uint32_t max_bitrate, uint32_t start_bitrate,
+			   double max_framerate, double scale_down,
+			   const char *degradation)
+{
+	janus::rtc::RTCEncodingSettings settings;
+	settings.min_bitrate = min_bitrate;
+	settings.max_bitrate = max_bitrate;
+	settings.start_bitrate = start_bitrate;
+	settings.max_framerate = max_framerate;
+	settings.scale_down = scale_down >= 1.0 ? scale_down : 1.0;
+	if (max_bitrate > 0 && min_bitrate > max_bitrate)
+		settings.min_bitrate = max_bitrate;
+
+	std::string d = degradation ? degradation : "";
+	if (d == "maintain-framerate")
+		settings.degradation =
+			janus::rtc::RTCDegradation::kMaintainFramerate;
+	else if (d == "maintain-resolution")
+		settings.degradation =
+			janus::rtc::RTCDegradation::kMaintainResolution;
+
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus_conn->SetEncodingSettings(settings);
+}
+
+void SetSimulcast(void *conn, int layers, const uint32_t *bitrates,
+		  const double *scales)
+{
+	static const char *kRids[] = {"h", "m", "l"};
+
+	std::vector<janus::rtc::RTCSimulcastLayer> simulcast;
+	if (layers > 1) {
+		layers = std::min(layers, 3);
+		for (int i = 0; i < layers; i++) {
+			janus::rtc::RTCSimulcastLayer layer;
+			layer.rid = kRids[i];
+			layer.max_bitrate = bitrates[i];
+			layer.scale_down = scales[i] >= 1.0 ? scales[i] : 1.0;
+			simulcast.push_back(layer);
+		}
+	}
+
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus_conn->SetSimulcastLayers(simulcast);
+}
+
+void SetVideoCodec(void *conn, const char *codec,
+		   const char *scalability_mode)
+{
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus_conn->SetVideoCodec(codec ? codec : "",
+				  scalability_mode ? scalability_mode : "");
+}
+
+static std::vector<std::string> SplitCodecs(const char *codecs)
+{
+	std::vector<std::string> list;
+	std::istringstream ss(codecs ? codecs : "");
+	std::string codec;
+	while (std::getline(ss, codec, ',')) {
+		codec.erase(0, codec.find_first_not_of(" \t"));
+		codec.erase(codec.find_last_not_of(" \t") + 1);
+		if (!codec.empty())
+			list.push_back(codec);
+	}
+	return list;
+}
+
+void SetSdpOptions(void *conn, const char *video_codecs,
+		   const char *audio_codecs, bool prune,
+		   uint32_t video_bandwidth, uint32_t audio_bandwidth, bool rtx)
+{
+	janus::rtc::SdpMungeOptions options;
+	options.video_codecs = SplitCodecs(video_codecs);
+	options.audio_codecs = SplitCodecs(audio_codecs);
+	options.prune_video_codecs = prune;
+	options.prune_audio_codecs = prune;
+	options.video_bandwidth = video_bandwidth;
+	options.audio_bandwidth = audio_bandwidth;
+	options.rtx = rtx;
+
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus_conn->SetSdpOptions(options);
+}
+
+void SetLossResilience(void *conn, bool nack, const char *video_fec,
+		       bool audio_red, bool opus_fec)
+{
+	std::string fec = video_fec ? video_fec : "ulpfec";
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus_conn->SetLossResilience(nack, fec == "ulpfec", fec == "flexfec",
+				      audio_red, opus_fec);
+}
+
+bool GetPublishTimeline(void *conn, char *buf, size_t size)
+{
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	std::string json = janus_conn->GetPublishTimeline();
+	if (json.size() + 1 > size)
+		return false;
+	memcpy(buf, json.c_str(), json.size() + 1);
+	return true;
+}
+
+uint64_t GetTotalBytes(void *conn)
+{
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	return janus_conn->GetTotalBytes();
+}
+
+int GetDroppedFrames(void *conn)
+{
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	return (int)janus_conn->GetDroppedFrames();
+}
+
+char *GetStatsJson(void *conn)
+{
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	return bstrdup(janus_conn->GetStatsJson().c_str());
+}
+
+char *GetLinkHealth(void *conn)
+{
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	return bstrdup(janus_conn->GetLinkHealth().c_str());
+}
+
+void GetSignalingByteCounters(uint64_t *raw_out, uint64_t *compressed_out,
+			      uint64_t *raw_in, uint64_t *compressed_in)
+{
+	auto stats = janus::signaling::DeflateExtension::Stats();
+	*raw_out = stats.raw_out;
+	*compressed_out = stats.compressed_out;
+	*raw_in = stats.raw_in;
+	*compressed_in = stats.compressed_in;
+}
+
+void Prewarm(void *conn, const char *url)
+{
+	auto janus_conn = static_cast<janus::JanusConnection *>(conn);
+	janus_conn->Prewarm(url);
 }
 
 void Publish(void *conn, const char *url, uint32_t id, const char *display,
@@ -32,6 +384,56 @@ void Unpublish(void *conn)
 	janus_conn->Unpublish();
 }
 
+void PublisherPublish(void *publisher, const char *url, uint32_t id,
+		      const char *display, uint64_t room, const char *pin)
+{
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	janus_pub->Publish(url, id, display, room, pin);
+}
+
+void PublisherUnpublish(void *publisher)
+{
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	janus_pub->Unpublish();
+}
+
+uint64_t GetPublisherTotalBytes(void *publisher)
+{
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	return janus_pub->GetTotalBytes();
+}
+
+int GetPublisherDroppedFrames(void *publisher)
+{
+	auto janus_pub = static_cast<janus::JanusPublisher *>(publisher);
+	return (int)janus_pub->GetDroppedFrames();
+}
+
+void PublisherSendVideoFrame(void *publisher, void *video_frame, int width,
+			     int height)
+{
+	auto janus_pub = reinterpret_cast<janus::JanusPublisher *>(publisher);
+	auto frame = reinterpret_cast<OBSVideoFrame *>(video_frame);
+	// `video_data` starts like `video_frame`
+	auto timestamp = reinterpret_cast<video_data *>(video_frame)->timestamp;
+	janus_pub->SendVideoFrame(frame, timestamp, width, height);
+}
+
+void PublisherSendVideoPacket(void *publisher, void *packet, int width,
+			      int height)
+{
+	auto janus_pub = reinterpret_cast<janus::JanusPublisher *>(publisher);
+	auto pkt = reinterpret_cast<OBSVideoPacket *>(packet);
+	janus_pub->SendVideoPacket(pkt, width, height);
+}
+
+void PublisherSendAudioFrame(void *publisher, void *audio_frame)
+{
+	auto janus_pub = reinterpret_cast<janus::JanusPublisher *>(publisher);
+	auto frame = reinterpret_cast<OBSAudioFrame *>(audio_frame);
+	janus_pub->SendAudioFrame(frame);
+}
+
 void SendVideoFrame(void *conn, void *video_frame, int width, int height)
 {
 	auto janus_conn = reinterpret_cast<janus::JanusConnection *>(conn);
@@ -5,17 +5,266 @@
 extern "C" {
 #endif
 
+/// <summary>
+/// Start loading libwebrtc & creating the peerconnection factory in the
+/// background, so it is ready by the time an output starts
+/// </summary>
+void InitializeRTCAsync();
+
+/// <summary>
+/// Load libwebrtc if not loaded yet, returns false if it is not available
+/// </summary>
+bool IsRTCAvailable();
+
+/// <summary>
+/// Release the WebRTC peerconnection factory, call this when the module unloads,
+/// waits for the peerconnections still being released
+/// </summary>
+void TerminateRTC();
+
 /// <summary>
 /// Create the `JanusConnection` instance
 /// </summary>
 /// <returns>the `JanusConnection` instance ptr</returns>
 void *CreateConncetion(bool encoded);
 /// <summary>
-/// Destory the `JanusConnection` instance
+/// Destory the `JanusConnection` instance, it is released in the background &
+/// the call returns right away
 /// </summary>
 /// <param name="conn">the `JanusConnection` instance ptr</param>
 void DestoryConnection(void *conn);
 
+/// <summary>
+/// Create the `JanusPublisher` instance, it fans the media out to its
+/// connections, see `GetPublisherConnection()`
+/// </summary>
+/// <returns>the `JanusPublisher` instance ptr</returns>
+void *CreatePublisher(bool encoded);
+/// <summary>
+/// Destory the `JanusPublisher` instance & its connections, they are released
+/// in the background
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+void DestoryPublisher(void *publisher);
+
+/// <summary>
+/// Set the extra rooms the feed is mirrored to, on the same or other janus
+/// servers, takes effect on the next `PublisherPublish()`
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+/// <param name="destinations">one "url room [pin]" per line, NULL or empty for none</param>
+void SetPublisherDestinations(void *publisher, const char *destinations);
+
+/// <summary>
+/// Set the janus servers the primary room fails over to when its signaling
+/// or ice connection breaks, the new path is published before the old one is
+/// torn down, takes effect on the next `PublisherPublish()`
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+/// <param name="backup_urls">one url per line, tried in order, the room must exist on each, NULL or empty for none</param>
+/// <param name="warm_standby">keep a session & handle attached on the next server</param>
+void SetPublisherFailover(void *publisher, const char *backup_urls,
+			  bool warm_standby);
+
+/// <summary>
+/// Called from a janus thread once the primary room rejected the publish & no
+/// backup server took it, nothing is sent anymore
+/// </summary>
+typedef void (*PublisherFailedCallback)(void *param, const char *reason);
+
+/// <summary>
+/// Set the callback telling the output to stop
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+/// <param name="callback">NULL for none</param>
+void SetPublisherFailedCallback(void *publisher,
+				PublisherFailedCallback callback, void *param);
+
+/// <summary>
+/// Get the number of connections, the primary one, one per extra destination
+/// & the failover standby
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+int GetPublisherConnectionCount(void *publisher);
+
+/// <summary>
+/// Get a connection of the publisher to apply the options to, owned by the
+/// publisher & valid until the destinations or backup servers change
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+/// <param name="index">0 for the primary connection, it changes on failover</param>
+/// <returns>the `JanusConnection` instance ptr, NULL if out of range</returns>
+void *GetPublisherConnection(void *publisher, int index);
+
+/// <summary>
+/// Set the number of io threads shared by all janus signaling connections,
+/// only takes effect before the first connection is made
+/// </summary>
+/// <param name="count">thread count, 0 means use the default</param>
+void SetSignalingThreadCount(int count);
+
+/// <summary>
+/// Stop the shared signaling io & worker threads, call this when the module
+/// unloads, waits for the connections still being released
+/// </summary>
+void ShutdownSignaling();
+
+/// <summary>
+/// Set the TLS options used when the janus server url is wss://
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="verify_peer">verify the server certificate & host name</param>
+/// <param name="ca_file">optional CA bundle(PEM) to trust, may be NULL</param>
+void SetTlsOptions(void *conn, bool verify_peer, const char *ca_file);
+
+/// <summary>
+/// Enable permessage-deflate for the signaling connection, takes effect when
+/// it connects again
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="enabled">negotiate compression with janus</param>
+/// <param name="level">zlib compression level 1~9</param>
+/// <param name="context_takeover">keep the compression window across messages</param>
+void SetSignalingCompression(void *conn, bool enabled, int level,
+			     bool context_takeover);
+
+/// <summary>
+/// Set the WebRTC encoder settings of the connection, outputs with different
+/// settings use different peerconnection factories
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="hw_acceleration">use hardware encoders if available</param>
+/// <param name="customized_video_encoder">use the custom video encoder</param>
+void SetRTCFactoryConfig(void *conn, bool hw_acceleration,
+			 bool customized_video_encoder);
+
+/// <summary>
+/// Set how the peerconnection gathers candidates, takes effect on the next
+/// `Publish()`
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="servers">one "uri [username password]" per line, "none" for no servers, NULL or empty for the defaults</param>
+/// <param name="transport_policy">all, relay or nohost, NULL means all</param>
+/// <param name="low_cost_networks_only">skip cellular & vpn networks</param>
+/// <param name="disable_tcp">no tcp candidates</param>
+/// <param name="disable_ipv6">no ipv6 candidates</param>
+/// <param name="candidate_pool_size">candidates gathered ahead of the offer</param>
+void SetIceOptions(void *conn, const char *servers,
+		   const char *transport_policy, bool low_cost_networks_only,
+		   bool disable_tcp, bool disable_ipv6, int candidate_pool_size);
+
+/// <summary>
+/// Set the video sender's encoding parameters, applied to a live
+/// peerconnection without renegotiating, except `start_bitrate`
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="min_bitrate">kbps, 0 means let webrtc decide</param>
+/// <param name="max_bitrate">kbps, 0 means let webrtc decide</param>
+/// <param name="start_bitrate">kbps, takes effect on the next `Publish()`</param>
+/// <param name="max_framerate">0 means the output frame rate</param>
+/// <param name="scale_down">resolution scale down factor, >= 1.0</param>
+/// <param name="degradation">balanced, maintain-framerate or maintain-resolution, may be NULL</param>
+void SetEncodingParameters(void *conn, uint32_t min_bitrate,
+			   uint32_t max_bitrate, uint32_t start_bitrate,
+			   double max_framerate, double scale_down,
+			   const char *degradation);
+
+/// <summary>
+/// Publish the raw video in `layers` simulcast layers, rid h, m & l from
+/// the highest quality, webrtc scales the captured frame for each layer
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="layers">2 or 3, 0 or 1 turns simulcast off</param>
+/// <param name="bitrates">max kbps of each layer, 0 means let webrtc decide</param>
+/// <param name="scales">resolution scale down of each layer, >= 1.0</param>
+void SetSimulcast(void *conn, int layers, const uint32_t *bitrates,
+		  const double *scales);
+
+/// <summary>
+/// Set the preferred codec & svc mode of the raw video, the room must allow
+/// the codec(& `video_svc` for VP9 spatial layers)
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="codec">VP8, VP9, AV1 or H264, NULL for the webrtc default</param>
+/// <param name="scalability_mode">e.g. L1T3 or L3T3_KEY, NULL for a single layer</param>
+void SetVideoCodec(void *conn, const char *codec,
+		   const char *scalability_mode);
+
+/// <summary>
+/// Set the rewrites of the offer & answer, the codecs apply to the next offer
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="video_codecs">comma separated, moved to the front in this order, e.g. "AV1,H264/profile-level-id=42e01f", NULL to keep the order</param>
+/// <param name="audio_codecs">same for audio, e.g. "opus"</param>
+/// <param name="prune">drop the codecs not listed</param>
+/// <param name="video_bandwidth">kbps, b=AS & b=TIAS of the answer, 0 to keep them</param>
+/// <param name="audio_bandwidth">same for audio</param>
+/// <param name="rtx">keep the rtx payloads</param>
+void SetSdpOptions(void *conn, const char *video_codecs,
+		   const char *audio_codecs, bool prune,
+		   uint32_t video_bandwidth, uint32_t audio_bandwidth, bool rtx);
+
+/// <summary>
+/// Set the protection against packet loss, negotiated with the next offer,
+/// see the "loss" of `GetLinkHealth()` for what it costs
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="nack">retransmit the packets janus asks for</param>
+/// <param name="video_fec">none, ulpfec or flexfec, flexfec needs a libwebrtc build advertising it, NULL for ulpfec</param>
+/// <param name="audio_red">send opus with redundancy if janus accepts RED</param>
+/// <param name="opus_fec">opus in-band fec</param>
+void SetLossResilience(void *conn, bool nack, const char *video_fec,
+		       bool audio_red, bool opus_fec);
+
+/// <summary>
+/// Get the time-to-first-frame breakdown of the last publish as json,
+/// milliseconds since `Publish()` per phase, -1 if not reached
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="buf">receives the nul terminated json</param>
+/// <param name="size">size of `buf`</param>
+/// <returns>false if `buf` is too small</returns>
+bool GetPublishTimeline(void *conn, char *buf, size_t size);
+
+/// <summary>
+/// Get the bytes sent since `Publish()`, from the webrtc stats
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+uint64_t GetTotalBytes(void *conn);
+
+/// <summary>
+/// Get the video frames captured but not encoded since `Publish()`
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+int GetDroppedFrames(void *conn);
+
+/// <summary>
+/// Get the last webrtc stats snapshot as json, free it with `bfree()`
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+char *GetStatsJson(void *conn);
+
+/// <summary>
+/// Get the media path state reported by janus(webrtcup, media, slowlink &
+/// hangup events) with its transitions, as json, free it with `bfree()`
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+char *GetLinkHealth(void *conn);
+
+/// <summary>
+/// Get the signaling bytes before & after compression of all connections
+/// </summary>
+void GetSignalingByteCounters(uint64_t *raw_out, uint64_t *compressed_out,
+			      uint64_t *raw_in, uint64_t *compressed_in);
+
+/// <summary>
+/// Connect to janus, create the session & attach the videoroom handle
+/// ahead of `Publish()`, they are kept alive by keep-alive messages
+/// </summary>
+/// <param name="conn">the `JanusConnection` instance ptr</param>
+/// <param name="url">the janus server(ws) address</param>
+void Prewarm(void *conn, const char *url);
+
 /// <summary>
 /// Publish media stream to janus video-room plugin
 /// </summary>
@@ -29,11 +278,44 @@ void Publish(void *conn, const char *url, uint32_t id, const char *display,
 	     uint64_t room, const char *pin);
 
 /// <summary>
-/// Cancel publish media stream to janus video-room plugin
+/// Cancel publish media stream to janus video-room plugin, returns right away,
+/// the peerconnection is closed in the background
 /// </summary>
 /// <param name="conn"></param>
 void Unpublish(void *conn);
 
+/// <summary>
+/// Publish to the primary room & the extra destinations with the same id &
+/// display, see `Publish()`
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+void PublisherPublish(void *publisher, const char *url, uint32_t id,
+		      const char *display, uint64_t room, const char *pin);
+
+/// <summary>
+/// Unpublish all the connections of the publisher
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+void PublisherUnpublish(void *publisher);
+
+/// <summary>
+/// Get the bytes sent & frames dropped summed over the connections
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+uint64_t GetPublisherTotalBytes(void *publisher);
+int GetPublisherDroppedFrames(void *publisher);
+
+/// <summary>
+/// Send the media to all the connections of the publisher, the video is
+/// wrapped once & shared by them & the other publishers
+/// </summary>
+/// <param name="publisher">the `JanusPublisher` instance ptr</param>
+void PublisherSendVideoFrame(void *publisher, void *video_frame, int width,
+			     int height);
+void PublisherSendVideoPacket(void *publisher, void *packet, int width,
+			      int height);
+void PublisherSendAudioFrame(void *publisher, void *audio_frame);
+
 /// <summary>
 /// Send video frame(NV12) to janus connetion
 /// </summary>
@@ -0,0 +1,441 @@
+#include "janus_publisher.h"
+#include "media_hub.h"
+
+#include <algorithm>
+
+#define blog(level, msg, ...) \
+	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
+
+namespace janus {
+
+JanusPublisher::JanusPublisher(bool send_encoded_data)
+	: use_encoded_data_(send_encoded_data),
+	  primary_(new JanusConnection(send_encoded_data)),
+	  standby_(nullptr),
+	  warm_standby_(false),
+	  active_url_(0),
+	  publishing_(false),
+	  id_(0),
+	  room_(0),
+	  failing_over_(false),
+	  failover_ts_(0),
+	  failover_generation_(0),
+	  bytes_base_(0),
+	  dropped_base_(0),
+	  failed_callback_(nullptr),
+	  failed_param_(nullptr),
+	  worker_("janus-failover"),
+	  switch_worker_("janus-switch", TaskQueuePool::Instance().Blocking())
+{
+	primary_->SetObserver(this);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	UpdateTargets();
+}
+
+JanusPublisher::~JanusPublisher()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		primary_->SetObserver(nullptr);
+		if (standby_ != nullptr)
+			standby_->SetObserver(nullptr);
+	}
+	// no failover step runs from here
+	worker_.Stop();
+	switch_worker_.Stop();
+
+	// wait for the frame in flight, then release in the background
+	delete targets_.Exchange(nullptr);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto conn : retired_)
+		JanusConnection::Destroy(conn);
+	retired_.clear();
+	for (auto &extra : extras_)
+		JanusConnection::Destroy(extra.conn);
+	extras_.clear();
+	JanusConnection::Destroy(standby_);
+	JanusConnection::Destroy(primary_);
+}
+
+JanusConnection *JanusPublisher::Primary() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return primary_;
+}
+
+void JanusPublisher::SetDestinations(
+	const std::vector<JanusDestination> &destinations)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<Extra> extras;
+	std::vector<JanusConnection *> released;
+	// raw video would be encoded once per destination
+	if (!destinations.empty() && !use_encoded_data_)
+		blog(LOG_ERROR,
+		     "fan-out needs encoded data, %zu destinations ignored",
+		     destinations.size());
+	for (auto &destination : destinations) {
+		if (!use_encoded_data_)
+			break;
+		// keep the connection of a destination listed before
+		JanusConnection *conn = nullptr;
+		for (auto &extra : extras_) {
+			if (extra.conn != nullptr &&
+			    extra.destination.url == destination.url &&
+			    extra.destination.room == destination.room) {
+				conn = extra.conn;
+				extra.conn = nullptr;
+				break;
+			}
+		}
+		if (conn == nullptr)
+			conn = new JanusConnection(use_encoded_data_);
+		extras.push_back({destination, conn});
+	}
+	for (auto &extra : extras_) {
+		if (extra.conn != nullptr)
+			released.push_back(extra.conn);
+	}
+	extras_.swap(extras);
+
+	// the obs threads stop feeding the released ones first
+	UpdateTargets();
+	for (auto conn : released)
+		JanusConnection::Destroy(conn);
+}
+
+void JanusPublisher::SetFailover(const std::vector<std::string> &backup_urls,
+				 bool warm_standby)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	backup_urls_ = backup_urls;
+	warm_standby_ = warm_standby;
+
+	if (!backup_urls_.empty() && standby_ == nullptr) {
+		standby_ = new JanusConnection(use_encoded_data_);
+		standby_->SetObserver(this);
+	} else if (backup_urls_.empty() && standby_ != nullptr &&
+		   !failing_over_) {
+		standby_->SetObserver(nullptr);
+		retired_.push_back(standby_);
+		auto standby = standby_;
+		switch_worker_.Post([this, standby]() {
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto it = std::find(retired_.begin(), retired_.end(),
+					    standby);
+			if (it == retired_.end())
+				return;
+			retired_.erase(it);
+			JanusConnection::Destroy(standby);
+		});
+		standby_ = nullptr;
+	}
+}
+
+void JanusPublisher::SetFailedCallback(PublishFailedCallback callback,
+				       void *param)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	failed_callback_ = callback;
+	failed_param_ = param;
+}
+
+size_t JanusPublisher::ConnectionCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return 1 + extras_.size() + (standby_ != nullptr ? 1 : 0);
+}
+
+JanusConnection *JanusPublisher::Connection(size_t index) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (index == 0)
+		return primary_;
+	if (index <= extras_.size())
+		return extras_[index - 1].conn;
+	if (index == extras_.size() + 1)
+		return standby_;
+	return nullptr;
+}
+
+void JanusPublisher::Publish(const char *url, uint32_t id,
+			     const char *display, uint64_t room,
+			     const char *pin)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	publishing_ = true;
+	id_ = id;
+	display_ = display ? display : "";
+	room_ = room;
+	pin_ = pin ? pin : "";
+	urls_.assign(1, url ? url : "");
+	urls_.insert(urls_.end(), backup_urls_.begin(), backup_urls_.end());
+	active_url_ = 0;
+	failing_over_ = false;
+	++failover_generation_;
+	bytes_base_ = 0;
+	dropped_base_ = 0;
+	UpdateTargets();
+
+	primary_->Publish(url, id, display, room, pin);
+	for (auto &extra : extras_) {
+		auto &d = extra.destination;
+		blog(LOG_INFO, "mirroring to room %llu on %s",
+		     (unsigned long long)d.room, d.url.c_str());
+		extra.conn->Publish(d.url.c_str(), id, display, d.room,
+				    d.pin.empty() ? nullptr : d.pin.c_str());
+	}
+	WarmStandby();
+}
+
+void JanusPublisher::Unpublish()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	publishing_ = false;
+	++failover_generation_;
+	if (failing_over_) {
+		failing_over_ = false;
+		UpdateTargets();
+		// after its publish still queued
+		auto standby = standby_;
+		switch_worker_.Post([standby]() { standby->Unpublish(); });
+	}
+
+	primary_->Unpublish();
+	for (auto &extra : extras_)
+		extra.conn->Unpublish();
+}
+
+uint64_t JanusPublisher::GetTotalBytes()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	uint64_t bytes = bytes_base_ + primary_->GetTotalBytes();
+	for (auto &extra : extras_)
+		bytes += extra.conn->GetTotalBytes();
+	return bytes;
+}
+
+uint32_t JanusPublisher::GetDroppedFrames()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	uint32_t dropped = dropped_base_ + primary_->GetDroppedFrames();
+	for (auto &extra : extras_)
+		dropped += extra.conn->GetDroppedFrames();
+	return dropped;
+}
+
+void JanusPublisher::SendVideoFrame(OBSVideoFrame *frame, uint64_t timestamp,
+				    int width, int height)
+{
+	auto targets = targets_.Read();
+	if (!targets)
+		return;
+
+	// converted & copied once for all the destinations & outputs
+	auto wrapped = MediaHub::Instance().WrapFrame(frame, timestamp, width,
+						      height);
+	for (auto conn : *targets)
+		conn->SendVideoFrame(wrapped);
+}
+
+void JanusPublisher::SendVideoPacket(OBSVideoPacket *pkt, int width,
+				     int height)
+{
+	auto targets = targets_.Read();
+	if (!targets)
+		return;
+
+	auto wrapped = MediaHub::Instance().WrapPacket(pkt, width, height);
+	for (auto conn : *targets)
+		conn->SendVideoPacket(wrapped);
+}
+
+void JanusPublisher::SendAudioFrame(OBSAudioFrame *frame)
+{
+	auto targets = targets_.Read();
+	if (!targets)
+		return;
+
+	// each peerconnection has its own audio source
+	for (auto conn : *targets)
+		conn->SendAudioFrame(frame);
+}
+
+void JanusPublisher::OnPathDown(JanusConnection *conn,
+				const std::string &reason)
+{
+	worker_.Post([this, conn, reason]() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (conn != primary_ || failing_over_)
+			return;
+		if (FailOver(reason))
+			return;
+		// the connection recovers in place or gives up & reports it
+		// through `OnPublishFailed()`, unless it did already
+		if (!conn->Publishing())
+			NotifyFailed(reason);
+		else
+			blog(LOG_WARNING,
+			     "path down (%s), no standby to fail over to",
+			     reason.c_str());
+	});
+}
+
+void JanusPublisher::OnPathUp(JanusConnection *conn)
+{
+	worker_.Post([this, conn]() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (conn == standby_ && failing_over_)
+			CompleteFailover();
+	});
+}
+
+void JanusPublisher::OnPublishFailed(JanusConnection *conn,
+				     const std::string &reason)
+{
+	worker_.Post([this, conn, reason]() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!publishing_)
+			return;
+		if (conn == standby_ && failing_over_) {
+			blog(LOG_WARNING, "standby on %s rejected the publish",
+			     urls_[NextUrl()].c_str());
+			CancelFailover(reason);
+		} else if (conn == primary_ && !failing_over_) {
+			if (!FailOver(reason))
+				NotifyFailed(reason);
+		}
+		// a failing over primary waits for the standby, an extra
+		// destination only loses its mirror
+	});
+}
+
+void JanusPublisher::UpdateTargets()
+{
+	auto targets = new Targets();
+	targets->push_back(primary_);
+	if (failing_over_)
+		targets->push_back(standby_);
+	for (auto &extra : extras_)
+		targets->push_back(extra.conn);
+	delete targets_.Exchange(targets);
+}
+
+size_t JanusPublisher::NextUrl() const
+{
+	return (active_url_ + 1) % urls_.size();
+}
+
+bool JanusPublisher::FailOver(const std::string &reason)
+{
+	if (!publishing_ || failing_over_ || standby_ == nullptr ||
+	    urls_.size() < 2)
+		return false;
+
+	const std::string &url = urls_[NextUrl()];
+	blog(LOG_WARNING, "path to %s down (%s), failing over to %s",
+	     urls_[active_url_].c_str(), reason.c_str(), url.c_str());
+
+	failing_over_ = true;
+	failover_ts_ = os_gettime_ns();
+	// a warm standby only has to join & negotiate
+	auto standby = standby_;
+	switch_worker_.Post([standby, url, id = id_, display = display_,
+			     room = room_, pin = pin_]() {
+		standby->Publish(url.c_str(), id, display.c_str(), room,
+				 pin.empty() ? nullptr : pin.c_str());
+	});
+	// make before break, the old path is fed until the new one is up
+	UpdateTargets();
+
+	uint32_t generation = ++failover_generation_;
+	worker_.PostDelayed(
+		[this, generation]() {
+			std::lock_guard<std::mutex> lock(mutex_);
+			AbortFailover(generation);
+		},
+		kFailoverTimeoutMs);
+	return true;
+}
+
+void JanusPublisher::CompleteFailover()
+{
+	JanusConnection *old = primary_;
+	primary_ = standby_;
+	standby_ = old;
+	active_url_ = NextUrl();
+	failing_over_ = false;
+	++failover_generation_;
+	// the old path is not fed anymore
+	UpdateTargets();
+
+	blog(LOG_INFO, "failed over to %s in %llu ms",
+	     urls_[active_url_].c_str(),
+	     (unsigned long long)((os_gettime_ns() - failover_ts_) / 1000000));
+
+	bytes_base_ += old->GetTotalBytes();
+	dropped_base_ += old->GetDroppedFrames();
+	switch_worker_.Post([old]() { old->Unpublish(); });
+	WarmStandby();
+}
+
+void JanusPublisher::AbortFailover(uint32_t generation)
+{
+	if (generation != failover_generation_ || !failing_over_)
+		return;
+
+	blog(LOG_WARNING,
+	     "standby on %s not up after %u ms, staying on %s",
+	     urls_[NextUrl()].c_str(), kFailoverTimeoutMs,
+	     urls_[active_url_].c_str());
+	CancelFailover("standby timed out");
+}
+
+void JanusPublisher::CancelFailover(const std::string &reason)
+{
+	failing_over_ = false;
+	++failover_generation_;
+	UpdateTargets();
+	auto standby = standby_;
+	switch_worker_.Post([standby]() { standby->Unpublish(); });
+	WarmStandby();
+
+	// rejected by the primary room while failing over
+	if (!primary_->Publishing())
+		NotifyFailed(reason);
+}
+
+void JanusPublisher::NotifyFailed(const std::string &reason)
+{
+	blog(LOG_ERROR, "publish failed: %s", reason.c_str());
+
+	// without `mutex_`, the owner may unpublish right away
+	worker_.Post([this, reason]() {
+		PublishFailedCallback callback;
+		void *param;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!publishing_)
+				return;
+			callback = failed_callback_;
+			param = failed_param_;
+		}
+		if (callback != nullptr)
+			callback(param, reason.c_str());
+	});
+}
+
+void JanusPublisher::WarmStandby()
+{
+	if (standby_ == nullptr || !warm_standby_ || urls_.size() < 2)
+		return;
+	// starts over if the previous session is gone with its server
+	auto standby = standby_;
+	std::string url = urls_[NextUrl()];
+	switch_worker_.Post(
+		[standby, url]() { standby->Prewarm(url.c_str()); });
+}
+
+} // namespace janus
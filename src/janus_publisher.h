@@ -0,0 +1,144 @@
+#pragma once
+
+#include "janus_connection.h"
+#include "task_queue.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace janus {
+// the primary room rejected the publish & no backup server took it, called
+// from the failover thread
+typedef void (*PublishFailedCallback)(void *param, const char *reason);
+
+// another room, on the same or another janus server, the feed is mirrored to
+struct JanusDestination {
+	std::string url;
+	uint64_t room = 0;
+	std::string pin;
+};
+
+// fans one obs feed out to the primary connection & the connections of the
+// extra destinations, each frame is wrapped once by `MediaHub` & shared by
+// all of them & the other outputs, with encoded data obs encodes once for
+// every destination
+//
+// the primary room fails over to the backup servers make-before-break: the
+// standby connection publishes while the broken path is still fed & takes
+// over as the primary once its ice is up, the old primary becomes the
+// standby
+class JanusPublisher : public JanusConnectionObserver {
+public:
+	explicit JanusPublisher(bool send_encoded_data);
+	~JanusPublisher();
+
+	// the connection publishing to the primary room, changes on failover
+	JanusConnection *Primary() const;
+	// creates the connections of the new destinations & releases the ones
+	// not listed anymore, takes effect on the next `Publish()`, ignored
+	// unless it sends encoded data
+	void SetDestinations(const std::vector<JanusDestination> &destinations);
+	// the servers the primary room fails over to in this order, the room
+	// must exist on each of them, `warm_standby` keeps a session & handle
+	// attached on the next one, takes effect on the next `Publish()`
+	void SetFailover(const std::vector<std::string> &backup_urls,
+			 bool warm_standby);
+	// tells the owner to stop, nullptr for none
+	void SetFailedCallback(PublishFailedCallback callback, void *param);
+	// the primary, the extra destinations & the standby if any
+	size_t ConnectionCount() const;
+	// 0 is the primary, the standby is the last one, nullptr if out of
+	// range, the connections live as long as the publisher unless the
+	// destinations or backup servers change
+	JanusConnection *Connection(size_t index) const;
+
+	// the primary publishes to `url` & `room`, the extra destinations to
+	// theirs, all with the same id & display
+	void Publish(const char *url, uint32_t id, const char *display,
+		     uint64_t room, const char *pin);
+	void Unpublish();
+
+	// summed over the destinations & the primaries before a failover
+	uint64_t GetTotalBytes();
+	uint32_t GetDroppedFrames();
+
+	// called from obs output, `timestamp` of the obs video frame
+	void SendVideoFrame(OBSVideoFrame *frame, uint64_t timestamp, int width,
+			    int height);
+	void SendVideoPacket(OBSVideoPacket *pkt, int width, int height);
+	void SendAudioFrame(OBSAudioFrame *frame);
+
+	// JanusConnectionObserver
+	virtual void OnPathDown(JanusConnection *conn,
+				const std::string &reason) override;
+	virtual void OnPathUp(JanusConnection *conn) override;
+	virtual void OnPublishFailed(JanusConnection *conn,
+				     const std::string &reason) override;
+
+	// the standby not up by then, stay on the primary
+	static const uint32_t kFailoverTimeoutMs = 10 * 1000;
+
+private:
+	struct Extra {
+		JanusDestination destination;
+		JanusConnection *conn;
+	};
+
+	bool use_encoded_data_;
+	// guards everything below but `targets_`, the failover runs on
+	// `worker_` with it held
+	mutable std::mutex mutex_;
+	JanusConnection *primary_;
+	std::vector<Extra> extras_;
+
+	// nullptr without backup servers
+	JanusConnection *standby_;
+	// dropped by `SetFailover()`, released after the calls queued for them
+	std::vector<JanusConnection *> retired_;
+	std::vector<std::string> backup_urls_;
+	bool warm_standby_;
+	// the url of `Publish()` followed by the backups, the primary is on
+	// `active_url_`
+	std::vector<std::string> urls_;
+	size_t active_url_;
+	// the publish replayed on the standby
+	bool publishing_;
+	uint32_t id_;
+	std::string display_;
+	uint64_t room_;
+	std::string pin_;
+	// the standby publishes & both are fed
+	bool failing_over_;
+	uint64_t failover_ts_;
+	// bumped to cancel the pending failover timeout
+	uint32_t failover_generation_;
+	// counters of the primaries before a failover
+	uint64_t bytes_base_;
+	uint32_t dropped_base_;
+	PublishFailedCallback failed_callback_;
+	void *failed_param_;
+	// on a queue shared with the connections
+	TaskRunner worker_;
+	// the failover's calls into the connections, which may wait for their
+	// signaling, in order & off the pool
+	TaskRunner switch_worker_;
+
+	// the connections the obs threads feed, swapped as a whole
+	typedef std::vector<JanusConnection *> Targets;
+	EpochPtr<Targets> targets_;
+
+	// call with `mutex_` held
+	void UpdateTargets();
+	size_t NextUrl() const;
+	// false if there is nothing to fail over to
+	bool FailOver(const std::string &reason);
+	void CompleteFailover();
+	void AbortFailover(uint32_t generation);
+	// back to the primary alone, fails if it is gone too
+	void CancelFailover(const std::string &reason);
+	void WarmStandby();
+	void NotifyFailed(const std::string &reason);
+};
+} // namespace janus
@@ -0,0 +1,180 @@
+#include "link_health.h"
+
+#include "nlohmann/json.hpp"
+
+#include <util/base.h>
+#include <util/platform.h>
+
+#define blog(level, msg, ...) \
+	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
+
+namespace janus {
+
+static const char *kStateNames[] = {
+	"idle", "negotiating", "up", "degraded", "down",
+};
+static_assert(sizeof(kStateNames) / sizeof(kStateNames[0]) ==
+		      (size_t)LinkState::kCount,
+	      "a name for each state");
+
+static const size_t kMaxTransitions = 32;
+
+static uint64_t ToMs(uint64_t ns)
+{
+	return ns / 1000000;
+}
+
+LinkHealth::LinkHealth()
+	: state_(LinkState::kIdle),
+	  start_ts_(0),
+	  last_slowlink_ts_(0),
+	  last_backoff_ts_(0),
+	  slowlinks_(0),
+	  audio_receiving_(false),
+	  video_receiving_(false)
+{
+}
+
+void LinkHealth::Start()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	start_ts_ = os_gettime_ns();
+	last_slowlink_ts_ = 0;
+	last_backoff_ts_ = 0;
+	slowlinks_ = 0;
+	audio_receiving_ = false;
+	video_receiving_ = false;
+	transitions_.clear();
+	TransitionTo(LinkState::kNegotiating, "publish");
+}
+
+void LinkHealth::Stop()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	TransitionTo(LinkState::kIdle, "unpublish");
+}
+
+void LinkHealth::OnWebrtcUp()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (state_ != LinkState::kDegraded)
+		TransitionTo(LinkState::kUp, "webrtcup");
+}
+
+void LinkHealth::OnMedia(const std::string &type, bool receiving)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (type == "audio")
+		audio_receiving_ = receiving;
+	else if (type == "video")
+		video_receiving_ = receiving;
+
+	if (receiving) {
+		if (state_ == LinkState::kNegotiating ||
+		    state_ == LinkState::kDown)
+			TransitionTo(LinkState::kUp, type + " flowing");
+	} else if (!audio_receiving_ && !video_receiving_ &&
+		   state_ != LinkState::kIdle) {
+		TransitionTo(LinkState::kDown, type + " stopped");
+	}
+}
+
+bool LinkHealth::OnSlowlink(bool uplink, uint32_t lost)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	// the downlink is janus sending to us, nothing we publish
+	if (!uplink || state_ == LinkState::kIdle)
+		return false;
+
+	uint64_t now = os_gettime_ns();
+	last_slowlink_ts_ = now;
+	slowlinks_++;
+	if (state_ != LinkState::kDown)
+		TransitionTo(LinkState::kDegraded,
+			     "slowlink, lost " + std::to_string(lost));
+
+	// janus repeats the event while the losses go on, give the previous
+	// step some time to take effect
+	if (last_backoff_ts_ != 0 &&
+	    ToMs(now - last_backoff_ts_) < kSlowlinkHoldMs)
+		return false;
+	last_backoff_ts_ = now;
+	return true;
+}
+
+void LinkHealth::OnHangup(const std::string &reason)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	audio_receiving_ = false;
+	video_receiving_ = false;
+	if (state_ != LinkState::kIdle)
+		TransitionTo(LinkState::kDown, "hangup: " + reason);
+}
+
+bool LinkHealth::CheckRecovered()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (state_ != LinkState::kDegraded ||
+	    ToMs(os_gettime_ns() - last_slowlink_ts_) < kSlowlinkHoldMs)
+		return false;
+
+	TransitionTo(LinkState::kUp, "no slowlink");
+	return true;
+}
+
+bool LinkHealth::SlowlinkWithin(uint32_t ms) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return last_slowlink_ts_ != 0 &&
+	       ToMs(os_gettime_ns() - last_slowlink_ts_) < ms;
+}
+
+LinkState LinkHealth::State() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return state_;
+}
+
+std::string LinkHealth::ToJson() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	nlohmann::json json = {{"state", StateName(state_)},
+			       {"slowlinks", slowlinks_},
+			       {"audio_receiving", audio_receiving_},
+			       {"video_receiving", video_receiving_},
+			       {"transitions", nlohmann::json::array()}};
+	for (auto &t : transitions_) {
+		int64_t ms = t.ts >= start_ts_ ? (int64_t)ToMs(t.ts - start_ts_)
+					       : -1;
+		json["transitions"].push_back({{"state", StateName(t.state)},
+					       {"ms", ms},
+					       {"reason", t.reason}});
+	}
+	return json.dump();
+}
+
+const char *LinkHealth::StateName(LinkState state)
+{
+	if (state >= LinkState::kCount)
+		return "unknown";
+	return kStateNames[(size_t)state];
+}
+
+void LinkHealth::TransitionTo(LinkState state, const std::string &reason)
+{
+	if (state == state_)
+		return;
+
+	uint64_t now = os_gettime_ns();
+	bool healthy = state == LinkState::kUp || state == LinkState::kIdle;
+	blog(healthy ? LOG_INFO : LOG_WARNING, "link %s -> %s (%s) at %llu ms",
+	     StateName(state_), StateName(state), reason.c_str(),
+	     (unsigned long long)(start_ts_ ? ToMs(now - start_ts_) : 0));
+
+	state_ = state;
+	transitions_.push_back({state, now, reason});
+	if (transitions_.size() > kMaxTransitions)
+		transitions_.pop_front();
+}
+
+} // namespace janus
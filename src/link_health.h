@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace janus {
+// the media path of a publish as seen by janus
+enum class LinkState {
+	kIdle = 0,    // not publishing
+	kNegotiating, // offer sent, waiting for webrtcup
+	kUp,          // janus receives our media
+	kDegraded,    // janus reported slowlink recently
+	kDown,        // hung up or janus stopped receiving
+	kCount,
+};
+
+// built from the asynchronous janus events(webrtcup, media, slowlink &
+// hangup) of the publisher handle, the transitions are kept with their
+// timestamps for the stats
+class LinkHealth {
+public:
+	LinkHealth();
+
+	// a new publish, back to negotiating
+	void Start();
+	void Stop();
+
+	void OnWebrtcUp();
+	// `type` is audio or video
+	void OnMedia(const std::string &type, bool receiving);
+	// `uplink` means janus misses packets we sent, returns true if the
+	// sender should back off, at most once per `kSlowlinkHoldMs`
+	bool OnSlowlink(bool uplink, uint32_t lost);
+	void OnHangup(const std::string &reason);
+
+	// back to up if no slowlink for `kSlowlinkHoldMs`, returns true on the
+	// transition
+	bool CheckRecovered();
+	// true if janus reported slowlink within `ms`
+	bool SlowlinkWithin(uint32_t ms) const;
+
+	LinkState State() const;
+	// {"state": "up", "slowlinks": 2, "transitions": [{"state": "up",
+	// "ms": 1200, "reason": "webrtcup"}, ...]}, `ms` since `Start()`
+	std::string ToJson() const;
+
+	static const char *StateName(LinkState state);
+
+	static const uint32_t kSlowlinkHoldMs = 5000;
+
+private:
+	struct Transition {
+		LinkState state;
+		uint64_t ts;
+		std::string reason;
+	};
+
+	mutable std::mutex mutex_;
+	LinkState state_;
+	uint64_t start_ts_;
+	uint64_t last_slowlink_ts_;
+	uint64_t last_backoff_ts_;
+	uint32_t slowlinks_;
+	bool audio_receiving_;
+	bool video_receiving_;
+	// the latest transitions only
+	std::deque<Transition> transitions_;
+
+	// with `mutex_` held
+	void TransitionTo(LinkState state, const std::string &reason);
+};
+} // namespace janus
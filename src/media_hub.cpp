@@ -0,0 +1,91 @@
+#include "media_hub.h"
+
+namespace janus {
+
+MediaHub &MediaHub::Instance()
+{
+	static MediaHub hub;
+	return hub;
+}
+
+MediaHub::MediaHub() : next_slot_(0), wrapped_(0), shared_(0) {}
+
+RTCVideoFrameRef MediaHub::WrapFrame(OBSVideoFrame *frame, uint64_t timestamp,
+				     int width, int height)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Slot *slot = Find(frame->data[0], timestamp, 0, width, height);
+	if (slot != nullptr) {
+		shared_++;
+		return slot->frame;
+	}
+
+	slot = Claim();
+	slot->source = frame->data[0];
+	slot->timestamp = timestamp;
+	slot->size = 0;
+	slot->width = width;
+	slot->height = height;
+	slot->frame = VideoFeederImpl::WrapFrame(frame, width, height);
+	wrapped_++;
+	return slot->frame;
+}
+
+RTCVideoFrameRef MediaHub::WrapPacket(OBSVideoPacket *pkt, int width,
+				      int height)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Slot *slot = Find(pkt->encoder, (uint64_t)pkt->pts, pkt->size, width,
+			  height);
+	if (slot != nullptr) {
+		shared_++;
+		return slot->frame;
+	}
+
+	slot = Claim();
+	slot->source = pkt->encoder;
+	slot->timestamp = (uint64_t)pkt->pts;
+	slot->size = pkt->size;
+	slot->width = width;
+	slot->height = height;
+	slot->frame = VideoFeederImpl::WrapPacket(pkt, width, height);
+	wrapped_++;
+	return slot->frame;
+}
+
+void MediaHub::Release()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto &slot : slots_)
+		slot = Slot();
+}
+
+MediaHub::Stats MediaHub::GetStats() const
+{
+	Stats stats;
+	stats.wrapped = wrapped_;
+	stats.shared = shared_;
+	return stats;
+}
+
+MediaHub::Slot *MediaHub::Find(const void *source, uint64_t timestamp,
+			       size_t size, int width, int height)
+{
+	for (auto &slot : slots_) {
+		if (slot.frame.get() != nullptr && slot.source == source &&
+		    slot.timestamp == timestamp && slot.size == size &&
+		    slot.width == width && slot.height == height)
+			return &slot;
+	}
+	return nullptr;
+}
+
+MediaHub::Slot *MediaHub::Claim()
+{
+	// the oldest one, still held by the outputs which got it
+	Slot *slot = &slots_[next_slot_];
+	next_slot_ = (next_slot_ + 1) % kSlots;
+	return slot;
+}
+
+} // namespace janus
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "janus_connection.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace janus {
+// the video of all the janus outputs in the process, the outputs of one obs
+// video mix get the same frames & an encoder shared by outputs the same
+// packets, each is converted & copied into a webrtc frame once & the frame
+// is shared by refcount, whatever number of outputs & destinations
+class MediaHub {
+public:
+	static MediaHub &Instance();
+
+	// the frame of obs video at `timestamp`, wrapped by the first output
+	// asking for it
+	RTCVideoFrameRef WrapFrame(OBSVideoFrame *frame, uint64_t timestamp,
+				   int width, int height);
+	RTCVideoFrameRef WrapPacket(OBSVideoPacket *pkt, int width, int height);
+
+	// drop the cached frames, before the peerconnection factory goes
+	void Release();
+
+	struct Stats {
+		// converted & copied
+		uint64_t wrapped = 0;
+		// handed to another output without a copy
+		uint64_t shared = 0;
+	};
+	Stats GetStats() const;
+
+	// the outputs are a few frames apart at most
+	static const size_t kSlots = 4;
+
+private:
+	MediaHub();
+
+	struct Slot {
+		// the obs buffer or encoder, with the time of the frame
+		const void *source = nullptr;
+		uint64_t timestamp = 0;
+		size_t size = 0;
+		int width = 0;
+		int height = 0;
+		RTCVideoFrameRef frame;
+	};
+
+	std::mutex mutex_;
+	Slot slots_[kSlots];
+	size_t next_slot_;
+	std::atomic<uint64_t> wrapped_;
+	std::atomic<uint64_t> shared_;
+
+	// call with `mutex_` held
+	Slot *Find(const void *source, uint64_t timestamp, size_t size,
+		   int width, int height);
+	Slot *Claim();
+};
+} // namespace janus
@@ -0,0 +1,92 @@
+#include "publish_timeline.h"
+
+#include <algorithm>
+
+#include "nlohmann/json.hpp"
+
+#include <util/platform.h>
+
+namespace janus {
+
+static const char *kPhaseNames[] = {
+	"ws_connected",  "session_created", "handle_attached",
+	"offer_created", "room_joined",     "ice_gathered",
+	"ice_connected", "dtls_connected",  "first_frame",
+};
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) ==
+		      (size_t)PublishPhase::kCount,
+	      "a name for each phase");
+
+PublishTimeline::PublishTimeline() : start_(0)
+{
+	for (auto &mark : marks_)
+		mark = 0;
+}
+
+void PublishTimeline::Start()
+{
+	for (auto &mark : marks_)
+		mark = 0;
+	start_ = os_gettime_ns();
+}
+
+bool PublishTimeline::Started() const
+{
+	return start_ != 0;
+}
+
+bool PublishTimeline::Mark(PublishPhase phase)
+{
+	uint64_t start = start_;
+	if (start == 0)
+		return false;
+
+	uint64_t expected = 0;
+	return marks_[(size_t)phase].compare_exchange_strong(
+		expected, std::max(os_gettime_ns(), start));
+}
+
+bool PublishTimeline::Reached(PublishPhase phase) const
+{
+	return marks_[(size_t)phase] != 0;
+}
+
+int64_t PublishTimeline::Elapsed(PublishPhase phase) const
+{
+	uint64_t mark = marks_[(size_t)phase];
+	uint64_t start = start_;
+	if (mark == 0 || start == 0 || mark < start)
+		return -1;
+	return (int64_t)((mark - start) / 1000000);
+}
+
+std::string PublishTimeline::Summary() const
+{
+	std::string summary;
+	for (size_t i = 0; i < (size_t)PublishPhase::kCount; i++) {
+		int64_t elapsed = Elapsed((PublishPhase)i);
+		if (!summary.empty())
+			summary += ", ";
+		summary += kPhaseNames[i];
+		summary += elapsed < 0 ? " -"
+				       : " " + std::to_string(elapsed) + " ms";
+	}
+	return summary;
+}
+
+std::string PublishTimeline::ToJson() const
+{
+	nlohmann::json json = nlohmann::json::object();
+	for (size_t i = 0; i < (size_t)PublishPhase::kCount; i++)
+		json[kPhaseNames[i]] = Elapsed((PublishPhase)i);
+	return json.dump();
+}
+
+const char *PublishTimeline::PhaseName(PublishPhase phase)
+{
+	if (phase >= PublishPhase::kCount)
+		return "unknown";
+	return kPhaseNames[(size_t)phase];
+}
+
+} // namespace janus
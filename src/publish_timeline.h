@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace janus {
+// the phases of going live, in the order they usually complete
+enum class PublishPhase {
+	kWebsocketConnected = 0,
+	kSessionCreated,
+	kHandleAttached,
+	kOfferCreated,
+	kRoomJoined,
+	kIceGathered,
+	kIceConnected,
+	kPeerConnected, // dtls done
+	kFirstFrame,
+	kCount,
+};
+
+// monotonic timestamps of each phase since `Publish()`, written from the
+// websocket, webrtc & obs threads
+class PublishTimeline {
+public:
+	PublishTimeline();
+
+	// start over, phases finished before(e.g. by pre-warming) count as 0 ms
+	void Start();
+	bool Started() const;
+	// record the first time `phase` is reached, returns false if it was
+	// recorded already or the timeline is not started
+	bool Mark(PublishPhase phase);
+	bool Reached(PublishPhase phase) const;
+
+	// milliseconds since `Start()`, -1 if the phase is not reached yet
+	int64_t Elapsed(PublishPhase phase) const;
+
+	// one line for the log, e.g. "ws_connected 120 ms, session_created ..."
+	std::string Summary() const;
+	// {"ws_connected": 120, ..., "first_frame": -1}
+	std::string ToJson() const;
+
+	static const char *PhaseName(PublishPhase phase);
+
+private:
+	std::atomic<uint64_t> start_;
+	std::array<std::atomic<uint64_t>, (size_t)PublishPhase::kCount> marks_;
+};
+} // namespace janus
@@ -4,7 +4,28 @@
 #include "rtc_desktop_device.h"
 #include "rtc_peerconnection_factory.h"
 
+#include <algorithm>
+#include <cctype>
+#include <future>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
 #include <util/base.h>
+#include <util/platform.h>
+
+#include "nlohmann/json.hpp"
 
 #define blog(level, msg, ...) \
 	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
@@ -13,11 +34,48 @@ using namespace libwebrtc;
 
 namespace janus::rtc {
 
-static scoped_refptr<RTCPeerConnectionFactory> g_pcf_ = nullptr;
+struct FactoryEntry {
+	scoped_refptr<RTCPeerConnectionFactory> pcf;
+	// the `RTCClient`s created from it
+	int clients;
+};
+
+// one factory per configuration, so changing the settings of one output
+// never terminates the factory others are using
+static std::map<RTCFactoryConfig, FactoryEntry> g_factories_;
+// the configuration `CreateClient()` uses when none is given
+static RTCFactoryConfig g_default_config_;
+// guards the factories & the `GlobalConfiguration` they are created with
+static std::mutex g_pcf_mutex_;
+// set when the factory is being created in the background
+static std::shared_future<void> g_pcf_ready_;
+static std::thread g_pcf_init_thread_;
+static bool g_rtc_initialized_ = false;
+
+#ifdef _WIN32
+static const char *kRTCLibraryName = "libwebrtc.dll";
+#endif
+
+static void ReleaseFactory(RTCPeerConnectionFactory *pcf);
+
+bool RTCFactoryConfig::operator<(const RTCFactoryConfig &other) const
+{
+	return std::tie(hardware_acceleration, customized_video_encoder,
+			customized_audio_input) <
+	       std::tie(other.hardware_acceleration,
+			other.customized_video_encoder,
+			other.customized_audio_input);
+}
+
+bool RTCFactoryConfig::operator==(const RTCFactoryConfig &other) const
+{
+	return !(*this < other) && !(other < *this);
+}
 
 RTCClient::RTCClient(std::string &id,
 		     scoped_refptr<RTCPeerConnectionFactory> pcf,
-		     std::vector<ICEServer> &ice_servers)
+		     const RTCIceSettings &ice,
+		     const RTCEncodingSettings &encoding)
 	: pcf_(pcf),
 	  local_video_track_(nullptr),
 	  remote_video_track_(nullptr),
@@ -26,18 +84,48 @@ RTCClient::RTCClient(std::string &id,
 	  events_cb_(nullptr),
 	  ice_candidate_cb_(nullptr),
 	  id_(id),
-	  media_track_update_cb_(nullptr)
+	  media_track_update_cb_(nullptr),
+	  encoding_(encoding)
 {
-	const size_t l = ice_servers.size();
-
 	rtc_config_ = std::make_unique<RTCConfiguration>();
-	for (int i = 0; i < l; i++) {
-		auto &t = ice_servers[i];
+
+	size_t l = ice.servers.size();
+	if (l > kMaxIceServerSize) {
+		blog(LOG_WARNING, "only the first %d of %zu ice servers are used",
+		     (int)kMaxIceServerSize, l);
+		l = kMaxIceServerSize;
+	}
+	for (size_t i = 0; i < l; i++) {
+		auto t = ice.servers[i];
 		IceServer server = {t["uri"], t["username"], t["passwd"]};
 		rtc_config_->ice_servers[i] = server;
 	}
-	// video bandwidth max value
-	rtc_config_->local_video_bandwidth = 8000;
+
+	switch (ice.transport_policy) {
+	case RTCIcePolicy::kRelay:
+		rtc_config_->type = IceTransportsType::kRelay;
+		break;
+	case RTCIcePolicy::kNoHost:
+		rtc_config_->type = IceTransportsType::kNoHost;
+		break;
+	default:
+		rtc_config_->type = IceTransportsType::kAll;
+		break;
+	}
+	rtc_config_->candidate_network_policy =
+		ice.low_cost_networks_only
+			? CandidateNetworkPolicy::kCandidateNetworkPolicyLowCost
+			: CandidateNetworkPolicy::kCandidateNetworkPolicyAll;
+	rtc_config_->tcp_candidate_policy =
+		ice.disable_tcp ? TcpCandidatePolicy::kTcpCandidatePolicyDisabled
+				: TcpCandidatePolicy::kTcpCandidatePolicyEnabled;
+	rtc_config_->disable_ipv6 = ice.disable_ipv6;
+	rtc_config_->disable_link_local_networks = ice.disable_link_local;
+	rtc_config_->ice_candidate_pool_size =
+		std::max(ice.candidate_pool_size, 0);
+	// video bandwidth max value(kbps)
+	rtc_config_->local_video_bandwidth =
+		encoding.max_bitrate > 0 ? encoding.max_bitrate : 8000;
 
 	pc_ = pcf->Create(*rtc_config_, RTCMediaConstraints::Create()),
 	pc_->RegisterRTCPeerConnectionObserver(this);
@@ -45,6 +133,8 @@ RTCClient::RTCClient(std::string &id,
 
 RTCClient::~RTCClient()
 {
+	if (pcf_)
+		ReleaseFactory(pcf_.get());
 	pcf_ = nullptr;
 	pc_ = nullptr;
 	events_cb_ = nullptr;
@@ -81,9 +171,9 @@ void RTCClient::Close()
 		}
 	}
 
-	// delete peerconnection
-	if (g_pcf_) {
-		g_pcf_->Delete(pc_);
+	// delete peerconnection, with the factory it was created by
+	if (pcf_) {
+		pcf_->Delete(pc_);
 	}
 }
 
@@ -102,10 +192,16 @@ void RTCClient::AddMediaTrackUpdateObserver(RTCClientMediaTrackEventObserver *cb
 	media_track_update_cb_ = cb;
 }
 
-void RTCClient::CreateOffer(void *params, OnCreatedSdpCallback callback)
+void RTCClient::CreateOffer(void *params, OnCreatedSdpCallback callback,
+			    bool ice_restart)
 {
 	scoped_refptr<RTCMediaConstraints> constraints =
 		RTCMediaConstraints::Create();
+	if (ice_restart) {
+		constraints->AddMandatoryConstraint(
+			RTCMediaConstraints::kIceRestart,
+			RTCMediaConstraints::kValueTrue);
+	}
 	pc_->CreateOffer(
 		[=](const string sdp, const string type) {
 			if (callback) {
@@ -261,6 +357,19 @@ void RTCClient::CreateMediaSender(owt::base::VideoFrameGeneratorInterface* video
 	string video_label("obsrtc_video");
 	local_video_track_ = pcf_->CreateVideoTrack(video, video_label);
 
+	RTCEncodingSettings settings;
+	{
+		std::lock_guard<std::mutex> lock(encoding_mutex_);
+		settings = encoding_;
+	}
+	if (local_video_track_ != nullptr &&
+	    (settings.simulcast_layers.size() > 1 ||
+	     !settings.scalability_mode.empty() ||
+	     !settings.video_codec.empty())) {
+		AddVideoTransceiver("obs-rtc-raw", settings);
+		return;
+	}
+
 	scoped_refptr<RTCMediaStream> stream = pcf_->CreateStream("obs-rtc-raw");
 	if (local_video_track_ != nullptr)
 		stream->AddTrack(local_video_track_);
@@ -281,6 +390,16 @@ void RTCClient::CreateMediaSender(owt::base::VideoEncoderInterface *encoder,
 	string video_label("obsrtc_video");
 	local_video_track_ = pcf_->CreateVideoTrack(encoder, video_label);
 
+	// obs hands us a single encoded stream, there is nothing to simulcast
+	// or layer
+	{
+		std::lock_guard<std::mutex> lock(encoding_mutex_);
+		if (encoding_.simulcast_layers.size() > 1 ||
+		    !encoding_.scalability_mode.empty())
+			blog(LOG_WARNING, "simulcast & svc need raw video, "
+					  "publishing a single layer");
+	}
+
 	scoped_refptr<RTCMediaStream> stream = pcf_->CreateStream("obs-rtc-encoded");
 	if (local_video_track_ != nullptr)
 		stream->AddTrack(local_video_track_);
@@ -290,6 +409,123 @@ void RTCClient::CreateMediaSender(owt::base::VideoEncoderInterface *encoder,
 	pc_->AddStream(stream);
 }
 
+static std::string ToLower(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(),
+		       [](unsigned char c) { return (char)tolower(c); });
+	return s;
+}
+
+// the scalability mode webrtc can encode with the configured codec &
+// simulcast layers, empty if there is none
+static std::string
+EffectiveScalabilityMode(const RTCEncodingSettings &settings)
+{
+	const std::string &mode = settings.scalability_mode;
+	if (mode.empty())
+		return mode;
+
+	// L1T2, L1T3... temporal layers only
+	bool temporal_only = mode.compare(0, 3, "L1T") == 0;
+	if (temporal_only)
+		return mode;
+
+	std::string codec = ToLower(settings.video_codec);
+	if (codec != "vp9" && codec != "av1") {
+		blog(LOG_WARNING,
+		     "scalability mode %s needs VP9 or AV1, not '%s'",
+		     mode.c_str(), settings.video_codec.c_str());
+		return "";
+	}
+	if (settings.simulcast_layers.size() > 1) {
+		blog(LOG_WARNING,
+		     "spatial scalability mode %s does not mix with simulcast",
+		     mode.c_str());
+		return "";
+	}
+	return mode;
+}
+
+void RTCClient::AddVideoTransceiver(const char *stream_id,
+				    const RTCEncodingSettings &settings)
+{
+	std::vector<string> ids = {string(stream_id)};
+	vector<string> stream_ids(ids);
+
+	if (local_audio_track_ != nullptr)
+		pc_->AddTrack(local_audio_track_, stream_ids);
+
+	std::string mode = EffectiveScalabilityMode(settings);
+
+	// webrtc scales the captured frame down for each simulcast layer
+	// (libyuv, simd) & runs one encoder per layer
+	std::vector<scoped_refptr<RTCRtpEncodingParameters>> encodings;
+	for (auto &layer : settings.simulcast_layers) {
+		if (settings.simulcast_layers.size() < 2)
+			break;
+		auto encoding = RTCRtpEncodingParameters::Create();
+		encoding->set_rid(string(layer.rid));
+		encoding->set_active(true);
+		encoding->set_scale_resolution_down_by(
+			std::max(layer.scale_down, 1.0));
+		if (layer.max_bitrate > 0)
+			encoding->set_max_bitrate_bps((int)layer.max_bitrate *
+						      1000);
+		if (!mode.empty())
+			encoding->set_scalability_mode(string(mode));
+		encodings.push_back(encoding);
+	}
+	if (encodings.empty()) {
+		auto encoding = RTCRtpEncodingParameters::Create();
+		encoding->set_active(true);
+		if (!mode.empty())
+			encoding->set_scalability_mode(string(mode));
+		encodings.push_back(encoding);
+	}
+
+	auto init = RTCRtpTransceiverInit::Create(
+		RTCRtpTransceiverDirection::kSendOnly, stream_ids,
+		vector<scoped_refptr<RTCRtpEncodingParameters>>(encodings));
+	auto transceiver = pc_->AddTransceiver(local_video_track_, init);
+	if (transceiver == nullptr) {
+		blog(LOG_ERROR, "add video transceiver failed");
+		return;
+	}
+
+	if (!settings.video_codec.empty())
+		SetVideoCodecPreference(transceiver, settings.video_codec);
+
+	blog(LOG_INFO,
+	     "video sender: %zu encodings, scalability mode '%s', codec '%s'",
+	     encodings.size(), mode.c_str(), settings.video_codec.c_str());
+}
+
+void RTCClient::SetVideoCodecPreference(
+	scoped_refptr<RTCRtpTransceiver> transceiver, const std::string &codec)
+{
+	auto capabilities = pcf_->GetRtpSenderCapabilities(
+		libwebrtc::RTCMediaType::VIDEO);
+	if (capabilities == nullptr)
+		return;
+
+	// move the preferred codec to the front, keep the rest(rtx, red...)
+	std::string mime = "video/" + ToLower(codec);
+	auto codecs = capabilities->codecs().std_vector();
+	auto it = std::stable_partition(
+		codecs.begin(), codecs.end(),
+		[&mime](const scoped_refptr<RTCRtpCodecCapability> &c) {
+			return ToLower(c->mime_type().std_string()) == mime;
+		});
+	if (it == codecs.begin()) {
+		blog(LOG_WARNING, "video codec %s is not supported",
+		     codec.c_str());
+		return;
+	}
+
+	transceiver->SetCodecPreferences(
+		vector<scoped_refptr<RTCRtpCodecCapability>>(codecs));
+}
+
 void RTCClient::SendAudioData(uint8_t *data, int64_t timestamp, size_t frames,
 		   uint32_t sample_rate, size_t num_channels)
 {
@@ -298,35 +534,190 @@ void RTCClient::SendAudioData(uint8_t *data, int64_t timestamp, size_t frames,
 	}
 }
 
-void RTCClient::ApplyBitrateSettings()
+// add one stats report to `stats`, returns false if it is not of interest,
+// `top_pixels` is the size of the video layer the frame stats are taken from
+static bool AccumulateStats(const nlohmann::json &report,
+			    RTCSenderStats &stats, int64_t &top_pixels)
+{
+	std::string type = report.value("type", "");
+	std::string kind = report.value("kind", "");
+
+	if (type == "outbound-rtp") {
+		stats.bytes_sent += report.value("bytesSent", 0ull);
+		stats.packets_sent += report.value("packetsSent", 0ull);
+		stats.retransmitted_packets_sent +=
+			report.value("retransmittedPacketsSent", 0ull);
+		stats.retransmitted_bytes_sent +=
+			report.value("retransmittedBytesSent", 0ull);
+		stats.nack_count += report.value("nackCount", 0u);
+		// one report per simulcast layer, the frames of the highest
+		// active one only, summing them up hides the dropped frames
+		int64_t pixels = (int64_t)report.value("frameWidth", 0u) *
+				 report.value("frameHeight", 0u);
+		if (kind == "video" && report.value("active", true) &&
+		    pixels > top_pixels) {
+			top_pixels = pixels;
+			stats.frames_encoded = report.value("framesEncoded", 0u);
+			stats.total_encode_time =
+				report.value("totalEncodeTime", 0.0);
+			stats.frames_per_second =
+				report.value("framesPerSecond", 0.0);
+			stats.frame_width = report.value("frameWidth", 0u);
+			stats.frame_height = report.value("frameHeight", 0u);
+			stats.quality_limitation_reason = report.value(
+				"qualityLimitationReason", "none");
+		}
+	} else if (type == "remote-inbound-rtp") {
+		stats.packets_lost += report.value("packetsLost", 0ll);
+		if (kind == "video")
+			stats.fraction_lost = report.value("fractionLost", 0.0);
+		if (kind == "video" || stats.rtt_ms == 0)
+			stats.rtt_ms = report.value("roundTripTime", 0.0) *
+				       1000.0;
+	} else if (type == "media-source") {
+		if (kind == "video")
+			stats.frames_captured += report.value("frames", 0u);
+	} else if (type == "candidate-pair") {
+		// the selected pair only
+		if (!report.value("nominated", false))
+			return false;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void RTCClient::GetStats(void *params, OnCollectedStatsCallback callback)
 {
+	pc_->GetStats(
+		[=](const vector<scoped_refptr<MediaRTCStats>> reports) {
+			RTCSenderStats stats;
+			int64_t top_pixels = -1;
+			nlohmann::json all = nlohmann::json::array();
+			for (int i = 0; i < reports.size(); i++) {
+				auto report = nlohmann::json::parse(
+					reports[i]->ToJson().std_string(),
+					nullptr, false);
+				if (report.is_discarded())
+					continue;
+				if (AccumulateStats(report, stats, top_pixels))
+					all.push_back(report);
+			}
+
+			if (stats.frames_captured > stats.frames_encoded)
+				stats.frames_dropped = stats.frames_captured -
+						       stats.frames_encoded;
+			if (callback) {
+				std::string json = all.dump();
+				std::string empty("");
+				callback(stats, json, empty, params);
+			}
+		},
+		[=](const char *erro) {
+			std::string e(erro ? erro : "");
+			blog(LOG_DEBUG, "get stats failed: %s", e.c_str());
+			if (callback) {
+				RTCSenderStats stats;
+				std::string json;
+				callback(stats, json, e, params);
+			}
+		});
+}
+
+void RTCClient::SetEncodingSettings(const RTCEncodingSettings &settings)
+{
+	{
+		std::lock_guard<std::mutex> lock(encoding_mutex_);
+		encoding_ = settings;
+	}
+	ApplyEncodingSettings();
+}
+
+static RTCDegradationPreference ToDegradationPreference(RTCDegradation d)
+{
+	switch (d) {
+	case RTCDegradation::kMaintainFramerate:
+		return RTCDegradationPreference::MAINTAIN_FRAMERATE;
+	case RTCDegradation::kMaintainResolution:
+		return RTCDegradationPreference::MAINTAIN_RESOLUTION;
+	default:
+		return RTCDegradationPreference::BALANCED;
+	}
+}
+
+bool RTCClient::ApplyEncodingSettings()
+{
+	RTCEncodingSettings settings;
+	{
+		std::lock_guard<std::mutex> lock(encoding_mutex_);
+		settings = encoding_;
+	}
+
 	auto senders = pc_->senders();
 	for (int i = 0; i < senders.size(); i++) {
-		auto& sender = senders[i];
+		auto &sender = senders[i];
 		auto sender_track = sender->track();
-		if (sender_track == nullptr)
-			return;
-		if (sender_track->kind().std_string() == "video") {
-			auto vec =
-				sender->parameters()->encodings().std_vector();
-			if (!vec.empty()) {
-				auto p = vec.front();
-				p->set_min_bitrate_bps(1000 * 1000 * 2);
-				p->set_max_bitrate_bps(1000 * 1000 * 4);
-			} else {
-				auto p1 = RTCRtpEncodingParameters::Create();
-				p1->set_min_bitrate_bps(1000 * 1000 * 2);
-				p1->set_max_bitrate_bps(1000 * 1000 * 4);
-				vec.push_back(p1);
+		if (sender_track == nullptr ||
+		    sender_track->kind().std_string() != "video")
+			continue;
+
+		auto parameters = sender->parameters();
+		auto encodings = parameters->encodings().std_vector();
+		// the encodings are created by the negotiation
+		if (encodings.empty())
+			return false;
+
+		std::string scalability_mode =
+			EffectiveScalabilityMode(settings);
+		for (auto &encoding : encodings) {
+			double scale_down = std::max(settings.scale_down, 1.0);
+			uint32_t max_bitrate = settings.max_bitrate;
+
+			// simulcast layers keep their own scale & bitrate, a layer
+			// without one is capped by the sender's
+			std::string rid = encoding->rid().std_string();
+			auto layer = std::find_if(
+				settings.simulcast_layers.begin(),
+				settings.simulcast_layers.end(),
+				[&rid](const RTCSimulcastLayer &l) {
+					return !rid.empty() && l.rid == rid;
+				});
+			if (layer != settings.simulcast_layers.end()) {
+				scale_down *= std::max(layer->scale_down, 1.0);
+				if (layer->max_bitrate > 0)
+					max_bitrate = layer->max_bitrate;
 			}
 
-			auto p = sender->parameters();
-			p->set_encodings(vec);
-			bool success = sender->set_parameters(p);
-			blog(LOG_INFO, "Update RTCRTPEncodingParameter result: %d", success);
-			break;
+			if (settings.min_bitrate > 0 &&
+			    (max_bitrate == 0 ||
+			     settings.min_bitrate <= max_bitrate))
+				encoding->set_min_bitrate_bps(
+					(int)settings.min_bitrate * 1000);
+			if (max_bitrate > 0)
+				encoding->set_max_bitrate_bps(
+					(int)max_bitrate * 1000);
+			if (settings.max_framerate > 0)
+				encoding->set_max_framerate(
+					settings.max_framerate);
+			encoding->set_scale_resolution_down_by(scale_down);
+			if (!scalability_mode.empty())
+				encoding->set_scalability_mode(
+					string(scalability_mode));
 		}
+		parameters->set_encodings(encodings);
+		parameters->set_degradation_preference(
+			ToDegradationPreference(settings.degradation));
+
+		bool success = sender->set_parameters(parameters);
+		blog(LOG_INFO,
+		     "encoding parameters: %u~%u kbps, %.1f fps, "
+		     "scale down %.2f, degradation %d, result: %d",
+		     settings.min_bitrate, settings.max_bitrate,
+		     settings.max_framerate, settings.scale_down,
+		     (int)settings.degradation, success);
+		return success;
 	}
+	return false;
 }
 
 std::string RTCSignalingStateToString(RTCSignalingState state)
@@ -411,8 +802,9 @@ void RTCClient::OnSignalingState(RTCSignalingState state)
 {
 	blog(LOG_DEBUG, "OnSignalingState: %s",
 	     RTCSignalingStateToString(state).c_str());
-	if (events_cb_ != nullptr) {
-		events_cb_->OnSignalingState(id_, state);
+	auto cb = events_cb_.load();
+	if (cb != nullptr) {
+		cb->OnSignalingState(id_, state);
 	}
 }
 
@@ -420,8 +812,9 @@ void RTCClient::OnPeerConnectionState(RTCPeerConnectionState state)
 {
 	blog(LOG_DEBUG, "OnPeerConnectionState: %s",
 	     RTCPeerConnectionStateToString(state).c_str());
-	if (events_cb_ != nullptr) {
-		events_cb_->OnPeerConnectionState(id_, state);
+	auto cb = events_cb_.load();
+	if (cb != nullptr) {
+		cb->OnPeerConnectionState(id_, state);
 	}
 }
 
@@ -429,8 +822,9 @@ void RTCClient::OnIceGatheringState(RTCIceGatheringState state)
 {
 	blog(LOG_DEBUG, "OnIceGatheringState: %s",
 	     RTCIceGatheringStateToString(state).c_str());
-	if (events_cb_ != nullptr) {
-		events_cb_->OnIceGatheringState(id_, state);
+	auto cb = events_cb_.load();
+	if (cb != nullptr) {
+		cb->OnIceGatheringState(id_, state);
 	}
 }
 
@@ -438,20 +832,22 @@ void RTCClient::OnIceConnectionState(RTCIceConnectionState state)
 {
 	blog(LOG_DEBUG, "OnIceConnectionState: %s",
 	     RTCIceConnectionStateToString(state).c_str());
-	if (events_cb_ != nullptr) {
-		events_cb_->OnIceConnectionState(id_, state);
+	auto cb = events_cb_.load();
+	if (cb != nullptr) {
+		cb->OnIceConnectionState(id_, state);
 	}
 }
 
 void RTCClient::OnIceCandidate(
 	scoped_refptr<libwebrtc::RTCIceCandidate> candidate)
 {
-	if (ice_candidate_cb_ != nullptr) {
+	auto cb = ice_candidate_cb_.load();
+	if (cb != nullptr) {
 		rtc::RTCIceCandidate candidate_ = {
 			candidate->candidate().std_string(),
 			candidate->sdp_mline_index(),
 			candidate->sdp_mid().std_string()};
-		ice_candidate_cb_->OnIceCandidateDiscoveried(id_, candidate_);
+		cb->OnIceCandidateDiscoveried(id_, candidate_);
 	}
 }
 
@@ -468,8 +864,9 @@ void RTCClient::OnRemoveStream(scoped_refptr<RTCMediaStream> stream)
 void RTCClient::OnRenegotiationNeeded()
 {
 	blog(LOG_DEBUG, "OnRenegotiationNeeded");
-	if (events_cb_ != nullptr) {
-		events_cb_->OnRenegotiationNeeded(id_);
+	auto cb = events_cb_.load();
+	if (cb != nullptr) {
+		cb->OnRenegotiationNeeded(id_);
 	}
 }
 
@@ -537,64 +934,208 @@ void UpdateRTCLogLevel(janus::rtc::RTCLogLevel level)
 	LibWebRTC::UpdateRTCLogLevel(level);
 }
 
-void IntializationPeerConnectionFactory()
+static void InitializeRTC()
 {
-	g_pcf_ = nullptr;
-	LibWebRTC::Initialize();
-	g_pcf_ = LibWebRTC::CreateRTCPeerConnectionFactory();
+	if (!g_rtc_initialized_) {
+		LibWebRTC::Initialize();
+		g_rtc_initialized_ = true;
+	}
 }
 
-void ResetPeerConnectionFactorySettings()
+// get the factory of `config` & count the client, `g_pcf_mutex_` held
+static scoped_refptr<RTCPeerConnectionFactory>
+AcquireFactory(const RTCFactoryConfig &config, bool count_client)
 {
-	if (g_pcf_) {
-		g_pcf_->Terminate();
-		g_pcf_ = nullptr;
+	auto it = g_factories_.find(config);
+	if (it == g_factories_.end()) {
+		InitializeRTC();
+		// the factory takes the global configuration when it is created
+		GlobalConfiguration::SetVideoHardwareAccelerationEnabled(
+			config.hardware_acceleration);
+		GlobalConfiguration::SetCustomizedVideoEncoderEnabled(
+			config.customized_video_encoder);
+		GlobalConfiguration::SetCustomizedAudioInputEnabled(
+			config.customized_audio_input);
+
+		FactoryEntry entry;
+		entry.pcf = LibWebRTC::CreateRTCPeerConnectionFactory();
+		entry.clients = 0;
+		it = g_factories_.emplace(config, entry).first;
+
+		blog(LOG_INFO,
+		     "peerconnection factory created, hw acceleration: %d, "
+		     "custom encoder: %d, custom audio: %d, factories: %zu",
+		     config.hardware_acceleration,
+		     config.customized_video_encoder,
+		     config.customized_audio_input, g_factories_.size());
 	}
+
+	if (count_client)
+		it->second.clients++;
+	return it->second.pcf;
 }
 
-void SetVideoHardwareAccelerationEnabled(bool enable)
+// terminate the factories no client uses, except the default one which is
+// kept warm for the next `CreateClient()`, `g_pcf_mutex_` held
+static void ReleaseIdleFactories()
 {
-	if (GlobalConfiguration::GetVideoHardwareAccelerationEnabled() ==
-	    enable)
-		return;
-	ResetPeerConnectionFactorySettings();
-	GlobalConfiguration::SetVideoHardwareAccelerationEnabled(enable);
+	for (auto it = g_factories_.begin(); it != g_factories_.end();) {
+		if (it->second.clients > 0 || it->first == g_default_config_) {
+			++it;
+			continue;
+		}
+		it->second.pcf->Terminate();
+		it = g_factories_.erase(it);
+	}
 }
 
-void SetCustomizedVideoEncoderEnabled(bool enable)
+static void ReleaseFactory(RTCPeerConnectionFactory *pcf)
 {
-	if (GlobalConfiguration::GetCustomizedVideoEncoderEnabled() ==
-	    enable)
-		return;
-	ResetPeerConnectionFactorySettings();
-	GlobalConfiguration::SetCustomizedVideoEncoderEnabled(enable);
+	std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+	for (auto &entry : g_factories_) {
+		if (entry.second.pcf.get() == pcf) {
+			entry.second.clients--;
+			break;
+		}
+	}
+	ReleaseIdleFactories();
 }
 
-RTCClient *CreateClient(
-	std::vector<ICEServer> &iceServers,
-	std::string &id)
+// block until the background initialization(if any) has finished
+static void WaitForPeerConnectionFactory()
 {
-	if (g_pcf_ == nullptr) {
+	std::shared_future<void> ready;
+	{
+		std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+		ready = g_pcf_ready_;
+	}
+	if (ready.valid())
+		ready.wait();
+}
+
+bool LoadRTCLibrary()
+{
+#ifdef _WIN32
+	// libwebrtc is linked with /DELAYLOAD, load it explicitly so a missing
+	// dll is reported here instead of faulting on the first call into it
+	static bool loaded = []() {
+		uint64_t start = os_gettime_ns();
+		HMODULE module = LoadLibraryA(kRTCLibraryName);
+		if (module == nullptr) {
+			blog(LOG_ERROR, "load %s failed, error: %lu",
+			     kRTCLibraryName, GetLastError());
+			return false;
+		}
+		blog(LOG_INFO, "%s loaded in %llu ms", kRTCLibraryName,
+		     (unsigned long long)((os_gettime_ns() - start) /
+					  1000000));
+		return true;
+	}();
+	return loaded;
+#else
+	return true;
+#endif
+}
+
+void InitializePeerConnectionFactoryAsync()
+{
+	std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+	if (g_pcf_ready_.valid() || !g_factories_.empty())
+		return;
+
+	std::packaged_task<void()> task([]() {
+		os_set_thread_name("janus-rtc-init");
+		if (!LoadRTCLibrary())
+			return;
+		uint64_t start = os_gettime_ns();
+
+		std::lock_guard<std::mutex> lock(g_pcf_mutex_);
 		// Default log level is none
 		UpdateRTCLogLevel(kNone);
-		SetVideoHardwareAccelerationEnabled(true);
-		//SetCustomizedVideoEncoderEnabled(true);
+		AcquireFactory(g_default_config_, false);
+
+		blog(LOG_INFO, "peerconnection factory ready in %llu ms",
+		     (unsigned long long)((os_gettime_ns() - start) /
+					  1000000));
+	});
+	g_pcf_ready_ = task.get_future().share();
+	g_pcf_init_thread_ = std::thread(std::move(task));
+}
 
-		IntializationPeerConnectionFactory();
+void TerminatePeerConnectionFactory()
+{
+	if (g_pcf_init_thread_.joinable())
+		g_pcf_init_thread_.join();
+
+	std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+	g_pcf_ready_ = std::shared_future<void>();
+	for (auto &entry : g_factories_) {
+		if (entry.second.clients > 0) {
+			blog(LOG_WARNING,
+			     "peerconnection factory still used by %d clients",
+			     entry.second.clients);
+		}
+		entry.second.pcf->Terminate();
 	}
+	g_factories_.clear();
+	if (g_rtc_initialized_) {
+		LibWebRTC::Terminate();
+		g_rtc_initialized_ = false;
+	}
+}
 
-	return new RTCClient(id, g_pcf_, iceServers);
+void SetVideoHardwareAccelerationEnabled(bool enable)
+{
+	std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+	g_default_config_.hardware_acceleration = enable;
+}
+
+void SetCustomizedVideoEncoderEnabled(bool enable)
+{
+	std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+	g_default_config_.customized_video_encoder = enable;
 }
 
 void SetCustomizedAudioInputEnabled(bool enable)
 {
-	bool changed = enable !=
-		       GlobalConfiguration::GetCustomizedAudioInputEnabled();
-	if (changed) {
-		// need to reset pcf in order to update `SetCustomizedAudioInputEnabled`.
-		ResetPeerConnectionFactorySettings();
+	std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+	g_default_config_.customized_audio_input = enable;
+}
+
+RTCClient *CreateClient(
+	std::vector<ICEServer> &iceServers,
+	std::string &id)
+{
+	RTCFactoryConfig config;
+	{
+		std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+		config = g_default_config_;
+	}
+	RTCIceSettings ice;
+	ice.servers = iceServers;
+	return CreateClient(ice, id, config);
+}
+
+RTCClient *CreateClient(const RTCIceSettings &ice, std::string &id,
+			const RTCFactoryConfig &config,
+			const RTCEncodingSettings &encoding)
+{
+	// `Start` lands here, wait for the factory warmed up by `create`
+	WaitForPeerConnectionFactory();
+	if (!LoadRTCLibrary())
+		return nullptr;
+
+	scoped_refptr<RTCPeerConnectionFactory> pcf;
+	{
+		std::lock_guard<std::mutex> lock(g_pcf_mutex_);
+		if (g_factories_.empty()) {
+			// Default log level is none
+			UpdateRTCLogLevel(kNone);
+		}
+		pcf = AcquireFactory(config, true);
 	}
-	GlobalConfiguration::SetCustomizedAudioInputEnabled(enable);
+
+	return new RTCClient(id, pcf, ice, encoding);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+
 #include "libwebrtc.h"
 #include "rtc_peerconnection.h"
 #include "framegeneratorinterface.h"
@@ -23,6 +26,87 @@ struct RTCIceCandidate {
 
 enum RTCLogLevel { kVebose = 0, kDebug, kInfo, kError, kNone };
 
+enum class RTCDegradation {
+	kBalanced = 0,
+	// lower the resolution first
+	kMaintainFramerate,
+	// lower the frame rate first
+	kMaintainResolution,
+};
+
+// one spatial layer of a simulcast video sender
+struct RTCSimulcastLayer {
+	// janus expects h, m & l
+	std::string rid;
+	// of the captured frame, 1.0 is the full resolution
+	double scale_down = 1.0;
+	// kbps, 0 means the sender's max bitrate
+	uint32_t max_bitrate = 0;
+};
+
+// the video sender's encoding parameters, 0 means let webrtc decide
+struct RTCEncodingSettings {
+	// kbps
+	uint32_t min_bitrate = 0;
+	uint32_t max_bitrate = 0;
+	uint32_t start_bitrate = 0;
+	double max_framerate = 0;
+	// >= 1.0, e.g. 2.0 sends 960x540 for a 1920x1080 output
+	double scale_down = 1.0;
+	RTCDegradation degradation = RTCDegradation::kBalanced;
+	// publish these layers of the raw video instead of a single encoding,
+	// the layers are fixed once the offer is created
+	std::vector<RTCSimulcastLayer> simulcast_layers;
+	// svc of the raw video, e.g. L1T3 or L3T3_KEY, spatial layers need
+	// VP9 or AV1, empty means a single layer
+	std::string scalability_mode;
+	// the preferred codec of the raw video, e.g. VP9, AV1, H264, empty means
+	// the webrtc default
+	std::string video_codec;
+};
+
+// the sender side stats of a peerconnection, counters are summed over the
+// audio & video senders, the frame counters are video only & of the highest
+// active simulcast layer, the one the captured frames are compared with
+struct RTCSenderStats {
+	uint64_t bytes_sent = 0;
+	uint64_t packets_sent = 0;
+	// resent on nack, lost packets recovered this way
+	uint64_t retransmitted_packets_sent = 0;
+	uint64_t retransmitted_bytes_sent = 0;
+	uint32_t nack_count = 0;
+	// reported by janus in the receiver reports
+	int64_t packets_lost = 0;
+	// of the video, lost in the last report interval, 0 ~ 1
+	double fraction_lost = 0;
+	double rtt_ms = 0;
+	// frames captured by the video source & not encoded
+	uint32_t frames_captured = 0;
+	uint32_t frames_encoded = 0;
+	uint32_t frames_dropped = 0;
+	// seconds spent encoding `frames_encoded`
+	double total_encode_time = 0;
+	double frames_per_second = 0;
+	uint32_t frame_width = 0;
+	uint32_t frame_height = 0;
+	// none, cpu, bandwidth or other
+	std::string quality_limitation_reason;
+};
+
+// the libwebrtc settings a peerconnection factory is created with, clients
+// of different configurations get different factories
+struct RTCFactoryConfig {
+	// intel media sdk hw acc for encoding
+	bool hardware_acceleration = true;
+	// custom encoder for video
+	bool customized_video_encoder = false;
+	// customized audio input(fake microphone), obs feeds the audio
+	bool customized_audio_input = true;
+
+	bool operator<(const RTCFactoryConfig &other) const;
+	bool operator==(const RTCFactoryConfig &other) const;
+};
+
 } // namespace janus::rtc
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -33,9 +117,14 @@ typedef void (*OnCreatedIceCandidateCallback)(
 	janus::rtc::RTCIceCandidate &candidate, std::string &error,
 	void *params);
 typedef void (*ErrorCallback)(std::string &error, void *params);
+typedef void (*OnCollectedStatsCallback)(janus::rtc::RTCSenderStats &stats,
+					 std::string &json, std::string &error,
+					 void *params);
 
 typedef libwebrtc::RTCVideoRenderer<
 	libwebrtc::scoped_refptr<libwebrtc::RTCVideoFrame>> *RTCVideoRendererPtr;
+// refcounted, a raw frame or an encoded packet may be fed to several tracks
+typedef libwebrtc::scoped_refptr<libwebrtc::RTCVideoFrame> RTCVideoFrameRef;
 
 typedef std::unordered_map<std::string, std::string> ICEServer;
 // end of typedefs
@@ -53,6 +142,28 @@ enum RTCMediaUpdate {
 	kAdded,
 };
 
+enum class RTCIcePolicy {
+	kAll = 0,
+	// relay(turn) candidates only
+	kRelay,
+	// no host candidates, e.g. hide the local addresses
+	kNoHost,
+};
+
+// how the peerconnection gathers candidates
+struct RTCIceSettings {
+	// "uri", "username" & "passwd", at most `kMaxIceServerSize` are used
+	std::vector<ICEServer> servers;
+	RTCIcePolicy transport_policy = RTCIcePolicy::kAll;
+	// skip cellular & vpn networks if others are available
+	bool low_cost_networks_only = false;
+	bool disable_tcp = false;
+	bool disable_ipv6 = false;
+	bool disable_link_local = false;
+	// candidates gathered before the offer is created
+	int candidate_pool_size = 0;
+};
+
 class RTCClientIceCandidateObserver {
 public:
 	virtual void OnIceCandidateDiscoveried(std::string &id,
@@ -87,7 +198,8 @@ public:
 	RTCClient(std::string &id,
 		  libwebrtc::scoped_refptr<libwebrtc::RTCPeerConnectionFactory>
 			  pcf,
-		  std::vector<ICEServer> &ice_servers);
+		  const RTCIceSettings &ice,
+		  const RTCEncodingSettings &encoding = RTCEncodingSettings());
 	~RTCClient();
 
 	// ID
@@ -97,7 +209,10 @@ public:
 	void Close();
 
 	// SDP
-	void CreateOffer(void *params, OnCreatedSdpCallback callback);
+	// `ice_restart` gathers new ice credentials on the same peerconnection,
+	// the senders & encoders are kept
+	void CreateOffer(void *params, OnCreatedSdpCallback callback,
+			 bool ice_restart = false);
 	void CreateAnswer(void *params, OnCreatedSdpCallback callback);
 	void SetLocalDescription(const char *sdp, const char *type,
 				 void *params, ErrorCallback callback);
@@ -106,6 +221,17 @@ public:
 	void GetLocalDescription(void *params, OnCreatedSdpCallback cb);
 	void GetRemoteDescription(void *params, OnCreatedSdpCallback cb);
 
+	// Encoding, applied to the video sender once negotiated, can be
+	// changed at any time without renegotiating
+	void SetEncodingSettings(const RTCEncodingSettings &settings);
+	// returns false if the video sender is not negotiated yet
+	bool ApplyEncodingSettings();
+
+	// Stats, handed to `callback` on the signaling thread once webrtc has
+	// collected them, `json` is the raw outbound-rtp, remote-inbound-rtp,
+	// media-source & candidate-pair reports
+	void GetStats(void *params, OnCollectedStatsCallback callback);
+
 	// ICE
 	void AddCandidate(const char *mid, int mid_mline_index,
 			  const char *candidate);
@@ -170,14 +296,23 @@ private:
 	libwebrtc::scoped_refptr<libwebrtc::RTCPeerConnectionFactory> pcf_;
 	libwebrtc::scoped_refptr<libwebrtc::RTCPeerConnection> pc_;
 	std::unique_ptr<libwebrtc::RTCConfiguration> rtc_config_;
+	std::mutex encoding_mutex_;
+	RTCEncodingSettings encoding_;
 
-	// Observers
-	RTCClientConnectionObserver *events_cb_;
-	RTCClientIceCandidateObserver *ice_candidate_cb_;
-	RTCClientMediaTrackEventObserver *media_track_update_cb_;
+	// audio track & a video transceiver with one encoding per simulcast
+	// layer, the scalability mode & codec preference of `settings`
+	void AddVideoTransceiver(const char *stream_id,
+				 const RTCEncodingSettings &settings);
+	void SetVideoCodecPreference(
+		libwebrtc::scoped_refptr<libwebrtc::RTCRtpTransceiver>
+			transceiver,
+		const std::string &codec);
 
-	// does not work, please set the local_video_bandwidth in `RTCConfiguration` before create `RTCClient`
-	void ApplyBitrateSettings();
+	// Observers, cleared from another thread when the client is handed
+	// over for teardown
+	std::atomic<RTCClientConnectionObserver *> events_cb_;
+	std::atomic<RTCClientIceCandidateObserver *> ice_candidate_cb_;
+	RTCClientMediaTrackEventObserver *media_track_update_cb_;
 };
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -185,14 +320,26 @@ private:
 
 // Update RTC log level
 void UpdateRTCLogLevel(janus::rtc::RTCLogLevel level);
-// Enable intel media sdk hw acc for encoding
+// Load libwebrtc on first use, returns false if it is not available
+bool LoadRTCLibrary();
+// Create the peerconnection factory on a background thread,
+// `CreateClient()` waits for it to be ready
+void InitializePeerConnectionFactoryAsync();
+// Release the factory & shut down libwebrtc, call it when the module unloads
+void TerminatePeerConnectionFactory();
+// Enable intel media sdk hw acc for encoding, applies to the clients created
+// afterwards without a `RTCFactoryConfig`
 void SetVideoHardwareAccelerationEnabled(bool enable);
-// Enable custom encoder for video
+// Enable custom encoder for video, same as above
 void SetCustomizedVideoEncoderEnabled(bool enable);
-// Create RTCClient
+// Create RTCClient with the default factory config
 RTCClient *CreateClient(std::vector<ICEServer> &iceServers, std::string &id);
-// Enable or disable customized audio input(fake microphone),
-// this function must called before `CreateClient()`
+// Create RTCClient on the factory of `config`, the factory is shared by the
+// clients of the same config & terminated when the last of them is deleted
+RTCClient *CreateClient(const RTCIceSettings &ice, std::string &id,
+			const RTCFactoryConfig &config,
+			const RTCEncodingSettings &encoding = RTCEncodingSettings());
+// Enable or disable customized audio input(fake microphone), same as above
 void SetCustomizedAudioInputEnabled(bool enable);
 
 // end of static methods
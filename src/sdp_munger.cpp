@@ -0,0 +1,407 @@
+#include "sdp_munger.h"
+
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+#include <util/base.h>
+
+#define blog(level, msg, ...) \
+	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
+
+namespace janus::rtc {
+
+static bool StartsWith(const std::string &s, const std::string &prefix)
+{
+	return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+static std::string ToLower(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(),
+		       [](unsigned char c) { return (char)tolower(c); });
+	return s;
+}
+
+static std::vector<std::string> Split(const std::string &s, char delim)
+{
+	std::vector<std::string> tokens;
+	std::stringstream ss(s);
+	std::string token;
+	while (std::getline(ss, token, delim)) {
+		if (!token.empty())
+			tokens.push_back(token);
+	}
+	return tokens;
+}
+
+// the pt of "a=rtpmap:96 VP8/90000", "a=fmtp:96 ..." or "a=rtcp-fb:96 ..."
+static std::string PayloadTypeOf(const std::string &line)
+{
+	for (const char *prefix : {"a=rtpmap:", "a=fmtp:", "a=rtcp-fb:"}) {
+		std::string p(prefix);
+		if (StartsWith(line, p))
+			return line.substr(p.size(), line.find(' ') - p.size());
+	}
+	return "";
+}
+
+// retransmission, redundancy & fec payloads protect the other codecs
+static bool IsProtection(const std::string &name)
+{
+	std::string lower = ToLower(name);
+	return lower == "rtx" || lower == "red" || lower == "ulpfec" ||
+	       StartsWith(lower, "flexfec");
+}
+
+// "H264/profile-level-id=42e01f" matches H264 with that fmtp parameter
+static bool MatchCodec(const std::string &spec, const std::string &name,
+		       const std::string &fmtp)
+{
+	size_t slash = spec.find('/');
+	if (ToLower(spec.substr(0, slash)) != ToLower(name))
+		return false;
+	if (slash == std::string::npos)
+		return true;
+	return ToLower(fmtp).find(ToLower(spec.substr(slash + 1))) !=
+	       std::string::npos;
+}
+
+SdpDocument::SdpDocument(const std::string &sdp)
+	: crlf_end_(!sdp.empty() && sdp.back() == '\n')
+{
+	std::stringstream ss(sdp);
+	std::string line;
+	while (std::getline(ss, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (StartsWith(line, "m=")) {
+			Media m;
+			m.kind = line.substr(2, line.find(' ') - 2);
+			media.push_back(std::move(m));
+		}
+		if (media.empty())
+			session.push_back(std::move(line));
+		else
+			media.back().lines.push_back(std::move(line));
+	}
+}
+
+std::string SdpDocument::ToString() const
+{
+	std::vector<const std::string *> lines;
+	for (auto &line : session)
+		lines.push_back(&line);
+	for (auto &m : media) {
+		for (auto &line : m.lines)
+			lines.push_back(&line);
+	}
+
+	std::string sdp;
+	for (size_t i = 0; i < lines.size(); i++) {
+		sdp += *lines[i];
+		if (i + 1 < lines.size() || crlf_end_)
+			sdp += "\r\n";
+	}
+	return sdp;
+}
+
+std::vector<std::string> SdpDocument::Media::PayloadTypes() const
+{
+	// m=video 9 UDP/TLS/RTP/SAVPF 96 97 ...
+	auto tokens = Split(lines.front(), ' ');
+	if (tokens.size() <= 3)
+		return {};
+	return std::vector<std::string>(tokens.begin() + 3, tokens.end());
+}
+
+std::string SdpDocument::Media::CodecName(const std::string &pt) const
+{
+	std::string prefix = "a=rtpmap:" + pt + " ";
+	for (auto &line : lines) {
+		if (StartsWith(line, prefix))
+			return line.substr(prefix.size(),
+					   line.find('/') - prefix.size());
+	}
+	return "";
+}
+
+std::string SdpDocument::Media::Fmtp(const std::string &pt) const
+{
+	std::string prefix = "a=fmtp:" + pt + " ";
+	for (auto &line : lines) {
+		if (StartsWith(line, prefix))
+			return line.substr(prefix.size());
+	}
+	return "";
+}
+
+void SdpDocument::Media::SetPayloadTypes(const std::vector<std::string> &pts)
+{
+	auto tokens = Split(lines.front(), ' ');
+	std::string mline;
+	for (size_t i = 0; i < 3 && i < tokens.size(); i++)
+		mline += (i > 0 ? " " : "") + tokens[i];
+	for (auto &pt : pts)
+		mline += " " + pt;
+	lines.front() = mline;
+
+	std::set<std::string> keep(pts.begin(), pts.end());
+	lines.erase(std::remove_if(lines.begin() + 1, lines.end(),
+				   [&keep](const std::string &line) {
+					   std::string pt = PayloadTypeOf(line);
+					   return !pt.empty() && pt != "*" &&
+						  keep.count(pt) == 0;
+				   }),
+		    lines.end());
+}
+
+void SdpDocument::Media::RemoveSsrcGroup(const std::string &semantics)
+{
+	// a=ssrc-group:FID <primary> <rtx>
+	std::string prefix = "a=ssrc-group:" + semantics + " ";
+	std::set<std::string> ssrcs;
+	for (auto &line : lines) {
+		if (!StartsWith(line, prefix))
+			continue;
+		auto tokens = Split(line.substr(prefix.size()), ' ');
+		for (size_t i = 1; i < tokens.size(); i++)
+			ssrcs.insert(tokens[i]);
+	}
+
+	lines.erase(std::remove_if(lines.begin(), lines.end(),
+				   [&](const std::string &line) {
+					   if (StartsWith(line, prefix))
+						   return true;
+					   if (!StartsWith(line, "a=ssrc:"))
+						   return false;
+					   std::string ssrc = line.substr(
+						   7, line.find(' ') - 7);
+					   return ssrcs.count(ssrc) > 0;
+				   }),
+		    lines.end());
+}
+
+void SdpDocument::Media::RemoveFeedback(const std::string &type)
+{
+	// a=rtcp-fb:96 nack
+	lines.erase(std::remove_if(lines.begin(), lines.end(),
+				   [&type](const std::string &line) {
+					   return StartsWith(line,
+							     "a=rtcp-fb:") &&
+						  line.substr(line.find(' ') +
+							      1) == type;
+				   }),
+		    lines.end());
+}
+
+void SdpDocument::Media::AddFmtpParam(const std::string &pt,
+				      const std::string &key,
+				      const std::string &param)
+{
+	std::string fmtp = "a=fmtp:" + pt + " ";
+	auto it = std::find_if(lines.begin(), lines.end(),
+			       [&fmtp](const std::string &line) {
+				       return StartsWith(line, fmtp);
+			       });
+	if (it != lines.end()) {
+		if (it->find(key) == std::string::npos)
+			*it += ";" + param;
+		return;
+	}
+
+	// add a fmtp line to the codecs without one
+	std::string rtpmap = "a=rtpmap:" + pt + " ";
+	it = std::find_if(lines.begin(), lines.end(),
+			  [&rtpmap](const std::string &line) {
+				  return StartsWith(line, rtpmap);
+			  });
+	if (it != lines.end())
+		lines.insert(it + 1, fmtp + param);
+}
+
+void SdpDocument::Media::SetBandwidth(uint32_t kbps)
+{
+	lines.erase(std::remove_if(lines.begin() + 1, lines.end(),
+				   [](const std::string &line) {
+					   return StartsWith(line, "b=");
+				   }),
+		    lines.end());
+
+	// b= goes right after c=
+	auto pos = std::find_if(lines.begin(), lines.end(),
+				[](const std::string &line) {
+					return StartsWith(line, "c=");
+				});
+	pos = pos == lines.end() ? lines.begin() + 1 : pos + 1;
+	pos = lines.insert(pos, "b=AS:" + std::to_string(kbps));
+	lines.insert(pos + 1,
+		     "b=TIAS:" + std::to_string((uint64_t)kbps * 1000));
+}
+
+static void MungeCodecs(SdpDocument::Media &m,
+			const std::vector<std::string> &specs, bool prune,
+			const SdpMungeOptions &options)
+{
+	auto pts = m.PayloadTypes();
+	std::set<std::string> removed;
+
+	// the primary codecs first
+	auto preferred = [&](const std::string &pt) {
+		std::string name = m.CodecName(pt);
+		std::string fmtp = m.Fmtp(pt);
+		for (size_t i = 0; i < specs.size(); i++) {
+			if (MatchCodec(specs[i], name, fmtp))
+				return (int)i;
+		}
+		return -1;
+	};
+	if (prune && !specs.empty()) {
+		std::set<std::string> pruned;
+		bool any_left = false;
+		for (auto &pt : pts) {
+			if (IsProtection(m.CodecName(pt)))
+				continue;
+			if (preferred(pt) < 0)
+				pruned.insert(pt);
+			else
+				any_left = true;
+		}
+		if (any_left)
+			removed = pruned;
+		else
+			blog(LOG_WARNING,
+			     "none of the %s codecs is offered, keep them all",
+			     m.kind.c_str());
+	}
+
+	// then the protection payloads, after the codecs they protect
+	for (auto &pt : pts) {
+		std::string name = ToLower(m.CodecName(pt));
+		std::string fmtp = m.Fmtp(pt);
+		bool remove = false;
+		if (name == "rtx") {
+			// apt=96
+			std::string apt = fmtp.substr(fmtp.find('=') + 1);
+			apt = apt.substr(0, apt.find(';'));
+			remove = !options.rtx || !options.nack ||
+				 removed.count(apt) > 0;
+		} else if (name == "red" && m.kind == "video") {
+			// only used to carry ulpfec
+			remove = !options.ulpfec;
+		} else if (name == "red") {
+			// audio red lists the redundant payloads, e.g. 111/111
+			for (auto &redundant : Split(fmtp, '/'))
+				remove = remove || removed.count(redundant) > 0;
+		} else if (name == "ulpfec") {
+			remove = !options.ulpfec;
+		} else if (StartsWith(name, "flexfec")) {
+			remove = !options.flexfec;
+		}
+		if (remove)
+			removed.insert(pt);
+	}
+
+	std::vector<std::string> kept;
+	for (auto &pt : pts) {
+		if (removed.count(pt) == 0)
+			kept.push_back(pt);
+	}
+	std::stable_sort(kept.begin(), kept.end(),
+			 [&](const std::string &a, const std::string &b) {
+				 int pa = preferred(a), pb = preferred(b);
+				 if (pa < 0 || pb < 0)
+					 return pa >= 0 && pb < 0;
+				 return pa < pb;
+			 });
+	if (kept != pts)
+		m.SetPayloadTypes(kept);
+
+	if (!options.rtx || !options.nack)
+		m.RemoveSsrcGroup("FID");
+	if (!options.flexfec)
+		m.RemoveSsrcGroup("FEC-FR");
+}
+
+// libwebrtc sends the first codec of the answer, red first means opus with
+// redundancy
+static void PreferAudioRed(SdpDocument::Media &m)
+{
+	auto pts = m.PayloadTypes();
+	std::stable_partition(pts.begin(), pts.end(),
+			      [&m](const std::string &pt) {
+				      return ToLower(m.CodecName(pt)) == "red";
+			      });
+	if (pts != m.PayloadTypes())
+		m.SetPayloadTypes(pts);
+}
+
+static void MungeResilience(SdpDocument::Media &m,
+			    const SdpMungeOptions &options)
+{
+	if (!options.nack)
+		m.RemoveFeedback("nack");
+	if (m.kind != "audio")
+		return;
+
+	if (options.audio_red)
+		PreferAudioRed(m);
+	if (options.opus_fec) {
+		for (auto &pt : m.PayloadTypes()) {
+			if (ToLower(m.CodecName(pt)) == "opus")
+				m.AddFmtpParam(pt, "useinbandfec",
+					       "useinbandfec=1");
+		}
+	}
+}
+
+static void AddStartBitrate(SdpDocument::Media &m, uint32_t kbps)
+{
+	std::string param = "x-google-start-bitrate=" + std::to_string(kbps);
+	for (auto &pt : m.PayloadTypes()) {
+		std::string name = m.CodecName(pt);
+		if (!name.empty() && !IsProtection(name))
+			m.AddFmtpParam(pt, "x-google-start-bitrate", param);
+	}
+}
+
+std::string MungeLocalOffer(const std::string &sdp,
+			    const SdpMungeOptions &options)
+{
+	SdpDocument doc(sdp);
+	for (auto &m : doc.media) {
+		if (m.kind == "video")
+			MungeCodecs(m, options.video_codecs,
+				    options.prune_video_codecs, options);
+		else if (m.kind == "audio")
+			MungeCodecs(m, options.audio_codecs,
+				    options.prune_audio_codecs, options);
+		else
+			continue;
+		MungeResilience(m, options);
+	}
+	return doc.ToString();
+}
+
+std::string MungeRemoteAnswer(const std::string &sdp,
+			      const SdpMungeOptions &options)
+{
+	SdpDocument doc(sdp);
+	for (auto &m : doc.media) {
+		if (m.kind == "video") {
+			if (options.video_bandwidth > 0)
+				m.SetBandwidth(options.video_bandwidth);
+			if (options.start_bitrate > 0)
+				AddStartBitrate(m, options.start_bitrate);
+		} else if (m.kind == "audio") {
+			if (options.audio_bandwidth > 0)
+				m.SetBandwidth(options.audio_bandwidth);
+		} else {
+			continue;
+		}
+		MungeResilience(m, options);
+	}
+	return doc.ToString();
+}
+
+} // namespace janus::rtc
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace janus::rtc {
+// rewrites of the offer we send & the answer we get from janus
+struct SdpMungeOptions {
+	// video codecs moved to the front of the offer in this order, a codec
+	// is its rtpmap name, optionally followed by "/" and a fmtp parameter
+	// it must have, e.g. "AV1", "H264/profile-level-id=42e01f"
+	std::vector<std::string> video_codecs;
+	// drop the video codecs not listed in `video_codecs`
+	bool prune_video_codecs = false;
+	// same for the audio codecs, e.g. "opus"
+	std::vector<std::string> audio_codecs;
+	bool prune_audio_codecs = false;
+	// keep the rtx payloads, without them the lost packets are resent on
+	// the media ssrc
+	bool rtx = true;
+
+	// loss resilience, libwebrtc protects the stream with what the answer
+	// negotiates
+	// nack feedback, without it nothing is retransmitted & rtx is dropped
+	bool nack = true;
+	// ulpfec of the video & the red it is carried in
+	bool ulpfec = true;
+	// only offered by the libwebrtc builds advertising it
+	bool flexfec = true;
+	// send opus with redundancy(RED, RFC 2198) by putting red first
+	bool audio_red = false;
+	// make our opus encoder add in-band fec
+	bool opus_fec = true;
+
+	// kbps, b=AS & b=TIAS of the answer's media sections, the sender never
+	// goes above them, 0 leaves the lines as they are
+	uint32_t video_bandwidth = 0;
+	uint32_t audio_bandwidth = 0;
+	// kbps, x-google-start-bitrate of the answer's video codecs
+	uint32_t start_bitrate = 0;
+};
+
+// a session description split into the session part & its media sections,
+// keeps the lines it does not touch as they are
+class SdpDocument {
+public:
+	explicit SdpDocument(const std::string &sdp);
+	std::string ToString() const;
+
+	struct Media {
+		// audio, video or application
+		std::string kind;
+		// starts with the m= line
+		std::vector<std::string> lines;
+
+		std::vector<std::string> PayloadTypes() const;
+		// rtpmap name of `pt`, e.g. "H264", empty if it has none
+		std::string CodecName(const std::string &pt) const;
+		// the fmtp parameters of `pt`, e.g. "apt=96"
+		std::string Fmtp(const std::string &pt) const;
+
+		// the m= line gets `pts` in this order, the attributes of the
+		// payloads left out are removed
+		void SetPayloadTypes(const std::vector<std::string> &pts);
+		// drop the ssrc-group(e.g. FID, FEC-FR) & the ssrcs it adds to
+		// the primary one
+		void RemoveSsrcGroup(const std::string &semantics);
+		// drop the rtcp feedback of `type`, e.g. "nack" but not
+		// "nack pli"
+		void RemoveFeedback(const std::string &type);
+		// add `param` to the fmtp of `pt` unless `key` is set already
+		void AddFmtpParam(const std::string &pt, const std::string &key,
+				  const std::string &param);
+		// replaces the b= lines, kbps
+		void SetBandwidth(uint32_t kbps);
+	};
+
+	std::vector<std::string> session;
+	std::vector<Media> media;
+
+private:
+	bool crlf_end_;
+};
+
+// reorder & prune the codecs, strip the disabled protection payloads
+std::string MungeLocalOffer(const std::string &sdp,
+			    const SdpMungeOptions &options);
+// the bandwidth lines, the start bitrate & the loss resilience
+std::string MungeRemoteAnswer(const std::string &sdp,
+			      const SdpMungeOptions &options);
+} // namespace janus::rtc
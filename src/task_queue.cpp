@@ -0,0 +1,200 @@
+#include "task_queue.h"
+
+#include <util/base.h>
+#include <util/platform.h>
+
+#include <algorithm>
+
+#define blog(level, msg, ...) \
+	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
+
+namespace janus {
+
+TaskQueue::TaskQueue(const char *name) : name_(name), stopped_(false)
+{
+	thread_ = std::thread(&TaskQueue::Run, this);
+}
+
+TaskQueue::~TaskQueue()
+{
+	Stop();
+}
+
+void TaskQueue::Post(Task task)
+{
+	PostDelayed(std::move(task), 0);
+}
+
+void TaskQueue::PostDelayed(Task task, uint32_t delay_ms)
+{
+	uint64_t run_at = os_gettime_ns() + (uint64_t)delay_ms * 1000000ULL;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (stopped_)
+			return;
+		// multimap keeps insertion order for equal keys
+		tasks_.emplace(run_at, std::move(task));
+	}
+	cv_.notify_one();
+}
+
+bool TaskQueue::IsCurrent() const
+{
+	return std::this_thread::get_id() == thread_.get_id();
+}
+
+void TaskQueue::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (stopped_)
+			return;
+		stopped_ = true;
+		tasks_.clear();
+	}
+	cv_.notify_one();
+
+	// a task is allowed to stop its own queue
+	if (IsCurrent())
+		thread_.detach();
+	else if (thread_.joinable())
+		thread_.join();
+}
+
+void TaskQueue::Run()
+{
+	os_set_thread_name(name_.c_str());
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!stopped_) {
+		if (tasks_.empty()) {
+			cv_.wait(lock);
+			continue;
+		}
+
+		auto it = tasks_.begin();
+		uint64_t now = os_gettime_ns();
+		if (it->first > now) {
+			cv_.wait_for(lock,
+				     std::chrono::nanoseconds(it->first - now));
+			continue;
+		}
+
+		Task task = std::move(it->second);
+		tasks_.erase(it);
+
+		lock.unlock();
+		task();
+		lock.lock();
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
+static const size_t kMaxPoolQueues = 4;
+
+TaskQueuePool &TaskQueuePool::Instance()
+{
+	static TaskQueuePool pool;
+	return pool;
+}
+
+TaskQueuePool::TaskQueuePool() : next_(0) {}
+
+TaskQueue *TaskQueuePool::Next()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (queues_.empty()) {
+		size_t count = std::min<size_t>(
+			kMaxPoolQueues,
+			std::max(2u, std::thread::hardware_concurrency() / 4));
+		for (size_t i = 0; i < count; i++) {
+			std::string name = "janus-worker-" + std::to_string(i);
+			queues_.push_back(
+				std::make_unique<TaskQueue>(name.c_str()));
+		}
+		blog(LOG_INFO, "worker pool started with %zu threads", count);
+	}
+
+	return queues_[next_++ % queues_.size()].get();
+}
+
+TaskQueue *TaskQueuePool::Blocking()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (blocking_ == nullptr)
+		blocking_ = std::make_unique<TaskQueue>("janus-rtc");
+	return blocking_.get();
+}
+
+void TaskQueuePool::Shutdown()
+{
+	std::vector<std::unique_ptr<TaskQueue>> queues;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		queues.swap(queues_);
+		if (blocking_ != nullptr)
+			queues.push_back(std::move(blocking_));
+	}
+	for (auto &queue : queues)
+		queue->Stop();
+}
+
+// the state of the runner whose task runs on this thread
+static thread_local const void *t_running_ = nullptr;
+
+TaskRunner::TaskRunner(const char *name)
+	: TaskRunner(name, TaskQueuePool::Instance().Next())
+{
+}
+
+TaskRunner::TaskRunner(const char *name, TaskQueue *queue)
+	: name_(name),
+	  queue_(queue),
+	  state_(std::make_shared<State>())
+{
+}
+
+TaskRunner::~TaskRunner()
+{
+	Stop();
+}
+
+void TaskRunner::Post(TaskQueue::Task task)
+{
+	queue_->Post(Wrap(std::move(task)));
+}
+
+void TaskRunner::PostDelayed(TaskQueue::Task task, uint32_t delay_ms)
+{
+	queue_->PostDelayed(Wrap(std::move(task)), delay_ms);
+}
+
+void TaskRunner::Stop()
+{
+	// called by our own task, which holds the lock already
+	if (t_running_ == state_.get()) {
+		state_->stopped = true;
+		return;
+	}
+
+	// waits for the task being run
+	std::lock_guard<std::mutex> lock(state_->mutex);
+	state_->stopped = true;
+}
+
+TaskQueue::Task TaskRunner::Wrap(TaskQueue::Task task)
+{
+	// the pending tasks outlive the runner on the shared queue
+	return [state = state_, task = std::move(task)]() {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		if (state->stopped)
+			return;
+		const void *outer = t_running_;
+		t_running_ = state.get();
+		task();
+		t_running_ = outer;
+	};
+}
+
+} // namespace janus
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace janus {
+// a single worker thread which runs posted & delayed tasks in order,
+// used for everything that must not block the websocket or webrtc threads
+class TaskQueue {
+public:
+	typedef std::function<void()> Task;
+
+	explicit TaskQueue(const char *name);
+	~TaskQueue();
+
+	// run the task as soon as possible
+	void Post(Task task);
+	// run the task after `delay_ms` milliseconds
+	void PostDelayed(Task task, uint32_t delay_ms);
+
+	// true if the caller is running on this queue's thread
+	bool IsCurrent() const;
+
+	// drop all pending tasks & join the worker thread
+	void Stop();
+
+private:
+	std::string name_;
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	// tasks ordered by (run at time in ns, post sequence)
+	std::multimap<uint64_t, Task> tasks_;
+	bool stopped_;
+
+	void Run();
+};
+
+// process-wide task queues shared by the connections & publishers, their
+// keep-alive, stats & recovery tasks are short, a few threads serve many
+// outputs
+class TaskQueuePool {
+public:
+	static TaskQueuePool &Instance();
+
+	// pick a queue for a new runner(round-robin), started on first use
+	TaskQueue *Next();
+	// the queue of the calls into libwebrtc, which may wait for its threads
+	// & must not hold up the keep-alives, started on first use
+	TaskQueue *Blocking();
+	// stop all queues, the runners must be stopped already
+	void Shutdown();
+
+private:
+	TaskQueuePool();
+
+	std::mutex mutex_;
+	std::vector<std::unique_ptr<TaskQueue>> queues_;
+	size_t next_;
+	std::unique_ptr<TaskQueue> blocking_;
+};
+
+// the tasks of one owner on a queue of `TaskQueuePool`, they run in order,
+// `Stop()` drops the pending ones & waits for the running one while the
+// queue keeps serving the other runners
+class TaskRunner {
+public:
+	explicit TaskRunner(const char *name);
+	// on `queue` instead of one of the pool's
+	TaskRunner(const char *name, TaskQueue *queue);
+	~TaskRunner();
+
+	void Post(TaskQueue::Task task);
+	void PostDelayed(TaskQueue::Task task, uint32_t delay_ms);
+
+	// from one of its own tasks it only drops the pending ones, the
+	// running task is the caller
+	void Stop();
+
+private:
+	struct State {
+		std::mutex mutex;
+		bool stopped = false;
+	};
+
+	std::string name_;
+	TaskQueue *queue_;
+	std::shared_ptr<State> state_;
+
+	TaskQueue::Task Wrap(TaskQueue::Task task);
+};
+} // namespace janus
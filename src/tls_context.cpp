@@ -0,0 +1,155 @@
+#include "tls_context.h"
+
+#ifdef JANUS_ENABLE_TLS
+
+#include <map>
+#include <mutex>
+
+#include <util/base.h>
+
+#define blog(level, msg, ...) \
+	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
+
+namespace janus::signaling {
+
+static std::mutex g_tls_mutex_;
+// key: "verify|ca_file"
+static std::map<std::string, SslContextPtr> g_contexts_;
+// the session cache of each context, key: "host:port", value: the newest
+// session we got from it
+typedef std::map<std::string, SSL_SESSION *> SessionCache;
+static std::map<SSL_CTX *, SessionCache> g_sessions_;
+
+static void FreeSessionKey(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+			   int idx, long argl, void *argp)
+{
+	delete static_cast<std::string *>(ptr);
+}
+
+// the "host:port" a connection stores its new sessions under
+static int SessionKeyIndex()
+{
+	static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+						FreeSessionKey);
+	return index;
+}
+
+static bool IsCachedContext(SSL_CTX *native)
+{
+	for (auto &ctx : g_contexts_) {
+		if (ctx.second->native_handle() == native)
+			return true;
+	}
+	return false;
+}
+
+// called by openssl whenever the server hands us a new session(ticket),
+// with TLS 1.3 this happens after the handshake
+static int OnNewSession(SSL *ssl, SSL_SESSION *session)
+{
+	auto key = static_cast<std::string *>(
+		SSL_get_ex_data(ssl, SessionKeyIndex()));
+	if (key == nullptr)
+		return 0;
+
+	std::lock_guard<std::mutex> lock(g_tls_mutex_);
+	// released by `ClearTlsCache()` while the connection lives on
+	SSL_CTX *native = SSL_get_SSL_CTX(ssl);
+	if (!IsCachedContext(native))
+		return 0;
+
+	auto &cache = g_sessions_[native];
+	auto it = cache.find(*key);
+	if (it != cache.end()) {
+		SSL_SESSION_free(it->second);
+		it->second = session;
+	} else {
+		cache.emplace(*key, session);
+	}
+
+	// we took the reference
+	return 1;
+}
+
+SslContextPtr GetSslContext(bool verify_peer, const std::string &ca_file)
+{
+	std::string key = (verify_peer ? "1|" : "0|") + ca_file;
+
+	std::lock_guard<std::mutex> lock(g_tls_mutex_);
+	auto it = g_contexts_.find(key);
+	if (it != g_contexts_.end())
+		return it->second;
+
+	auto ctx = websocketpp::lib::make_shared<SslContext>(
+		SslContext::tls_client);
+	websocketpp::lib::asio::error_code ec;
+	ctx->set_options(SslContext::default_workarounds |
+				 SslContext::no_sslv2 | SslContext::no_sslv3 |
+				 SslContext::no_tlsv1 | SslContext::no_tlsv1_1,
+			 ec);
+
+	if (verify_peer) {
+		ctx->set_verify_mode(websocketpp::lib::asio::ssl::verify_peer,
+				     ec);
+		ctx->set_default_verify_paths(ec);
+		if (!ca_file.empty()) {
+			ctx->load_verify_file(ca_file, ec);
+			if (ec) {
+				blog(LOG_WARNING,
+				     "load CA file %s failed: %s",
+				     ca_file.c_str(), ec.message().c_str());
+			}
+		}
+	} else {
+		ctx->set_verify_mode(websocketpp::lib::asio::ssl::verify_none,
+				     ec);
+	}
+
+	// keep client sessions ourselves, openssl's internal store is for
+	// the server side lookup only
+	SSL_CTX *native = ctx->native_handle();
+	SSL_CTX_set_session_cache_mode(native,
+				       SSL_SESS_CACHE_CLIENT |
+					       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(native, OnNewSession);
+
+	g_contexts_.emplace(key, ctx);
+	return ctx;
+}
+
+void ApplyCachedSession(SSL *ssl, const std::string &host, uint16_t port)
+{
+	std::string key = host + ":" + std::to_string(port);
+	SSL_set_ex_data(ssl, SessionKeyIndex(), new std::string(key));
+
+	std::lock_guard<std::mutex> lock(g_tls_mutex_);
+	auto cache = g_sessions_.find(SSL_get_SSL_CTX(ssl));
+	if (cache == g_sessions_.end())
+		return;
+	auto it = cache->second.find(key);
+	if (it == cache->second.end())
+		return;
+
+	if (!SSL_SESSION_is_resumable(it->second)) {
+		SSL_SESSION_free(it->second);
+		cache->second.erase(it);
+		return;
+	}
+
+	SSL_set_session(ssl, it->second);
+}
+
+void ClearTlsCache()
+{
+	std::lock_guard<std::mutex> lock(g_tls_mutex_);
+	for (auto &cache : g_sessions_) {
+		for (auto &s : cache.second)
+			SSL_SESSION_free(s.second);
+	}
+	g_sessions_.clear();
+	g_contexts_.clear();
+}
+
+} // namespace janus::signaling
+
+#endif // JANUS_ENABLE_TLS
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifdef JANUS_ENABLE_TLS
+
+#include <cstdint>
+#include <string>
+
+#include "websocketpp/common/asio_ssl.hpp"
+
+namespace janus::signaling {
+typedef websocketpp::lib::asio::ssl::context SslContext;
+typedef websocketpp::lib::shared_ptr<SslContext> SslContextPtr;
+
+// get the ssl context shared by all connections with the same verify
+// settings, client session caching is enabled on it, each context keeps
+// its own sessions
+SslContextPtr GetSslContext(bool verify_peer, const std::string &ca_file);
+
+// offer the last session of `host:port` got through the context of `ssl`
+// to the server so the reconnect resumes it instead of running a full
+// handshake, a session never crosses contexts: one from a context not
+// verifying the peer would skip the certificate check of another
+void ApplyCachedSession(SSL *ssl, const std::string &host, uint16_t port);
+
+// release all the cached sessions & contexts
+void ClearTlsCache();
+} // namespace janus::signaling
+
+#endif // JANUS_ENABLE_TLS
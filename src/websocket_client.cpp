@@ -1,33 +1,356 @@
 #include "websocket_client.h"
+#include "deflate_extension.h"
+#include "tls_context.h"
+#include <future>
 #include <util/base.h>
 
+#ifdef JANUS_ENABLE_TLS
+#include "websocketpp/config/asio_client.hpp"
+#endif
+
 #define blog(level, msg, ...) \
 	blog(level, "[janus-videoroom] " msg, ##__VA_ARGS__)
 
 namespace janus::signaling {
-WebsocketClient::WebsocketClient()
-	: connected_(false), url_(""), observer_(nullptr), thread_(nullptr)
+
+// bound the memory used by a slow link
+static const size_t kMaxQueuedMessages = 512;
+static const size_t kMaxQueuedBytes = 4 * 1024 * 1024;
+// stop handing data to the socket above this amount in flight
+static const size_t kMaxBufferedBytes = 256 * 1024;
+static const int kDrainRetryMs = 20;
+
+/////////////////////////////////////////////////////////////////////////////////
+// websocketpp configs with permessage-deflate
+
+struct asio_deflate_client : public websocketpp::config::asio_client {
+	typedef asio_deflate_client type;
+	typedef DeflateExtension permessage_deflate_type;
+};
+
+#ifdef JANUS_ENABLE_TLS
+struct asio_tls_deflate_client : public websocketpp::config::asio_tls_client {
+	typedef asio_tls_deflate_client type;
+	typedef DeflateExtension permessage_deflate_type;
+};
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////
+
+class WebsocketEndpoint
+	: public std::enable_shared_from_this<WebsocketEndpoint> {
+public:
+	virtual ~WebsocketEndpoint() {}
+
+	virtual bool Secure() const = 0;
+	virtual bool Compressed() const = 0;
+	// create & start a new connection, `hdl` is set to the new connection
+	virtual bool Connect(const std::string &url,
+			     websocketpp::connection_hdl &hdl) = 0;
+	virtual void Close(websocketpp::connection_hdl hdl,
+			   websocketpp::close::status::value code,
+			   const std::string &reason) = 0;
+	virtual websocketpp::lib::error_code
+	Send(websocketpp::connection_hdl hdl, const std::string &msg) = 0;
+	virtual size_t BufferedAmount(websocketpp::connection_hdl hdl) = 0;
+	// stop calling back into the owner & terminate the connection if it
+	// is not closing already
+	virtual void Retire(websocketpp::connection_hdl hdl) = 0;
+	virtual std::string FailReason(websocketpp::connection_hdl hdl) = 0;
+	virtual std::string CloseReason(websocketpp::connection_hdl hdl) = 0;
+	virtual void OnOpened(websocketpp::connection_hdl hdl) {}
+};
+
+template<typename Config> class EndpointImpl : public WebsocketEndpoint {
+public:
+	typedef websocketpp::client<Config> Client;
+
+	explicit EndpointImpl(WebsocketClient *owner) : owner_(owner)
+	{
+		client_.clear_access_channels(websocketpp::log::alevel::all);
+		client_.clear_error_channels(websocketpp::log::alevel::all);
+		client_.init_asio(owner->io_service_.get());
+	}
+
+	virtual bool Secure() const override { return client_.is_secure(); }
+
+	virtual bool Compressed() const override
+	{
+		return std::is_same<typename Config::permessage_deflate_type,
+				    DeflateExtension>::value;
+	}
+
+	virtual bool Connect(const std::string &url,
+			     websocketpp::connection_hdl &hdl) override
+	{
+		websocketpp::lib::error_code ec;
+		typename Client::connection_ptr conn =
+			client_.get_connection(url, ec);
+		if (ec) {
+			blog(LOG_DEBUG, "init connection error: %s",
+			     ec.message().c_str());
+			return false;
+		}
+
+		hdl = conn->get_handle();
+		conn->add_subprotocol("janus-protocol");
+
+		conn->set_open_handler(websocketpp::lib::bind(
+			&WebsocketClient::OnConnectionOpen, owner_));
+		conn->set_close_handler(websocketpp::lib::bind(
+			&WebsocketClient::OnConnectionClose, owner_));
+		conn->set_fail_handler(websocketpp::lib::bind(
+			&WebsocketClient::OnConnectionFail, owner_));
+		conn->set_message_handler(websocketpp::lib::bind(
+			&WebsocketClient::OnRecvMsg, owner_,
+			websocketpp::lib::placeholders::_1,
+			websocketpp::lib::placeholders::_2));
+		if (Compressed()) {
+			// on the io thread, serialized with the strand
+			auto owner = owner_;
+			conn->set_tcp_post_init_handler(
+				[owner](websocketpp::connection_hdl) {
+					DeflateExtension::BindNext(
+						owner->deflate_options_,
+						owner->deflate_counters_);
+				});
+		}
+
+		client_.connect(conn);
+		return true;
+	}
+
+	virtual void Close(websocketpp::connection_hdl hdl,
+			   websocketpp::close::status::value code,
+			   const std::string &reason) override
+	{
+		client_.close(hdl, code, reason);
+	}
+
+	virtual websocketpp::lib::error_code
+	Send(websocketpp::connection_hdl hdl, const std::string &msg) override
+	{
+		websocketpp::lib::error_code ec;
+		auto con = client_.get_con_from_hdl(hdl, ec);
+		if (ec)
+			return ec;
+		return con->send(msg, websocketpp::frame::opcode::text);
+	}
+
+	virtual size_t BufferedAmount(websocketpp::connection_hdl hdl) override
+	{
+		websocketpp::lib::error_code ec;
+		auto con = client_.get_con_from_hdl(hdl, ec);
+		if (ec)
+			return 0;
+		return con->get_buffered_amount();
+	}
+
+	virtual void Retire(websocketpp::connection_hdl hdl) override
+	{
+		websocketpp::lib::error_code ec;
+		auto con = client_.get_con_from_hdl(hdl, ec);
+		if (ec)
+			return;
+		con->set_open_handler(nullptr);
+		con->set_message_handler(nullptr);
+		con->set_tcp_post_init_handler(nullptr);
+		// the connection refers to its endpoint until it is released
+		// (termination handler, random generator, tls handlers), keep
+		// us alive as long as it runs
+		auto self = this->shared_from_this();
+		con->set_close_handler([self](websocketpp::connection_hdl) {});
+		con->set_fail_handler([self](websocketpp::connection_hdl) {});
+		// one closing finishes its handshake, bounded by the close
+		// timeout of websocketpp
+		if (con->get_state() == websocketpp::session::state::closing)
+			return;
+		con->terminate(websocketpp::error::make_error_code(
+			websocketpp::error::operation_canceled));
+	}
+
+	virtual std::string FailReason(websocketpp::connection_hdl hdl) override
+	{
+		websocketpp::lib::error_code ec;
+		auto con = client_.get_con_from_hdl(hdl, ec);
+		if (ec)
+			return ec.message();
+
+		std::string server = con->get_response_header("Server");
+		std::string error_reason = con->get_ec().message();
+		blog(LOG_DEBUG,
+		     "connection failed, server info: %s, reason: %s",
+		     server.c_str(), error_reason.c_str());
+		return error_reason;
+	}
+
+	virtual std::string CloseReason(websocketpp::connection_hdl hdl) override
+	{
+		websocketpp::lib::error_code ec;
+		auto con = client_.get_con_from_hdl(hdl, ec);
+		if (ec)
+			return ec.message();
+
+		std::stringstream s;
+		s << "close code: " << con->get_remote_close_code() << " ("
+		  << websocketpp::close::status::get_string(
+			     con->get_remote_close_code())
+		  << "), close reason: " << con->get_remote_close_reason();
+		return s.str();
+	}
+
+protected:
+	Client client_;
+	WebsocketClient *owner_;
+};
+
+#ifdef JANUS_ENABLE_TLS
+template<typename Config> class TlsEndpointImpl : public EndpointImpl<Config> {
+public:
+	typedef websocketpp::lib::asio::ssl::stream<
+		websocketpp::lib::asio::ip::tcp::socket>
+		SslStream;
+
+	TlsEndpointImpl(WebsocketClient *owner, const TlsOptions &options)
+		: EndpointImpl<Config>(owner), options_(options)
+	{
+		// our connections keep us alive, see `Retire()`
+		this->client_.set_tls_init_handler(
+			[this](websocketpp::connection_hdl) {
+				return GetSslContext(options_.verify_peer,
+						     options_.ca_file);
+			});
+		this->client_.set_socket_init_handler(
+			[this](websocketpp::connection_hdl hdl,
+			       SslStream &stream) {
+				auto con = this->client_.get_con_from_hdl(hdl);
+				std::string host = con->get_host();
+				SSL *ssl = stream.native_handle();
+
+				SSL_set_tlsext_host_name(ssl, host.c_str());
+				ApplyCachedSession(ssl, host, con->get_port());
+
+				if (options_.verify_peer) {
+					stream.set_verify_callback(
+						websocketpp::lib::asio::ssl::
+							rfc2818_verification(
+								host));
+				}
+			});
+	}
+
+	virtual void OnOpened(websocketpp::connection_hdl hdl) override
+	{
+		websocketpp::lib::error_code ec;
+		auto con = this->client_.get_con_from_hdl(hdl, ec);
+		if (ec)
+			return;
+
+		SSL *ssl = con->get_socket().native_handle();
+		blog(LOG_INFO, "TLS connected to %s, %s handshake(%s)",
+		     con->get_host().c_str(),
+		     SSL_session_reused(ssl) ? "resumed" : "full",
+		     SSL_get_version(ssl));
+	}
+
+private:
+	TlsOptions options_;
+};
+#endif // JANUS_ENABLE_TLS
+
+static std::shared_ptr<WebsocketEndpoint>
+CreateEndpoint(WebsocketClient *owner, bool secure, bool compressed,
+	       const TlsOptions &options)
 {
-	client_.clear_access_channels(websocketpp::log::alevel::all);
-	client_.clear_error_channels(websocketpp::log::alevel::all);
+	if (!secure) {
+		if (compressed)
+			return std::make_shared<
+				EndpointImpl<asio_deflate_client>>(owner);
+		return std::make_shared<
+			EndpointImpl<websocketpp::config::asio_client>>(owner);
+	}
 
-	client_.init_asio();
-	client_.start_perpetual();
+#ifdef JANUS_ENABLE_TLS
+	if (compressed)
+		return std::make_shared<
+			TlsEndpointImpl<asio_tls_deflate_client>>(owner,
+								  options);
+	return std::make_shared<
+		TlsEndpointImpl<websocketpp::config::asio_tls_client>>(owner,
+								       options);
+#else
+	blog(LOG_ERROR, "wss:// is not supported, build with TLS enabled");
+	return nullptr;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////
 
-	thread_.reset(
-		new websocketpp::lib::thread(&IWebsocketClient::run, &client_));
+WebsocketClient::WebsocketClient()
+	: connected_(false),
+	  url_(""),
+	  observer_(nullptr),
+	  queued_bytes_(0),
+	  drain_scheduled_(false),
+	  detached_(false),
+	  close_pending_(false),
+	  close_code_(websocketpp::close::status::normal),
+	  tls_changed_(false),
+	  compression_(false),
+	  deflate_counters_(std::make_shared<DeflateCounters>())
+{
+	// multiplex this connection onto the process-wide io threads
+	io_service_ = IoContextPool::Instance().Next();
+	strand_ = std::make_unique<IoContextPool::IoService::strand>(
+		*io_service_);
+	drain_timer_ = std::make_unique<websocketpp::lib::asio::steady_timer>(
+		*io_service_);
 }
 
 WebsocketClient::~WebsocketClient()
 {
-	client_.stop_perpetual();
+	// the io thread outlives us, make sure nothing calls back after this
+	Detach();
 
-	if (connected_)
-		Close();
+	blog(LOG_DEBUG, "");
+}
+
+void WebsocketClient::Detach()
+{
+	auto detach = [this]() {
+		if (detached_)
+			return;
+		observer_ = nullptr;
+		drain_timer_->cancel();
+		if (connected_ && !close_pending_) {
+			close_pending_ = true;
+			close_code_ = websocketpp::close::status::going_away;
+			close_reason_.clear();
+		}
+		// e.g. the hangup still waiting for a slow link
+		if (close_pending_) {
+			DrainQueue(true);
+			FinishClose();
+		}
+		detached_ = true;
 
-	thread_->join();
+		RetireConnection();
+	};
 
-	blog(LOG_DEBUG, "");
+	// the handlers of our io_service all run on its one thread, another
+	// pool thread must wait for them like any other thread
+	if (io_service_->stopped() || IoContextPool::IsIoThread(*io_service_)) {
+		detach();
+		return;
+	}
+
+	// run on the io thread so it can not race a handler in progress
+	std::promise<void> done;
+	strand_->post([&]() {
+		detach();
+		done.set_value();
+	});
+	done.get_future().wait();
 }
 
 std::string WebsocketClient::URL() const
@@ -45,47 +368,103 @@ void WebsocketClient::AddObserver(WebsocketClientInterface *observer)
 	observer_ = observer;
 }
 
+void WebsocketClient::RetireConnection()
+{
+	if (endpoint_)
+		endpoint_->Retire(hdl_);
+	connected_ = false;
+}
+
+void WebsocketClient::SetTlsOptions(const TlsOptions &options)
+{
+	strand_->post([this, self = shared_from_this(), options]() {
+		if (options.verify_peer == tls_options_.verify_peer &&
+		    options.ca_file == tls_options_.ca_file)
+			return;
+
+		tls_options_ = options;
+		// the live connection belongs to the tls endpoint, it is
+		// recreated with the new options by the next `Connect()`
+		tls_changed_ = true;
+	});
+}
+
+void WebsocketClient::SetCompression(bool enabled,
+				     const DeflateOptions &options)
+{
+	// the live connection keeps what it negotiated, the next `Connect()`
+	// switches the endpoint if needed
+	strand_->post([this, self = shared_from_this(), enabled, options]() {
+		compression_ = enabled;
+		deflate_options_ = options;
+	});
+}
+
+DeflateStats WebsocketClient::CompressionStats() const
+{
+	return deflate_counters_->Stats();
+}
+
 void WebsocketClient::Connect(const std::string &url)
 {
-	websocketpp::lib::error_code ec;
-	IWebsocketClient::connection_ptr conn = client_.get_connection(url, ec);
-	if (ec) {
-		blog(LOG_DEBUG, "init connection error: %s",
-		     ec.message().c_str());
-		return;
-	}
 	url_ = url;
 
-	try {
-		hdl_ = conn->get_handle();
-		conn->add_subprotocol("janus-protocol");
+	// everything touching the endpoint runs on the strand
+	strand_->post([this, self = shared_from_this(), url]() {
+		if (detached_)
+			return;
+		// the previous connection must not call back into the new one
+		RetireConnection();
 
-		conn->set_open_handler(websocketpp::lib::bind(
-			&WebsocketClient::OnConnectionOpen, this));
-		conn->set_close_handler(websocketpp::lib::bind(
-			&WebsocketClient::OnConnectionClose, this));
-		conn->set_fail_handler(websocketpp::lib::bind(
-			&WebsocketClient::OnConnectionFail, this));
-		conn->set_message_handler(websocketpp::lib::bind(
-			&WebsocketClient::OnRecvMsg, this,
-			websocketpp::lib::placeholders::_1,
-			websocketpp::lib::placeholders::_2));
+		bool secure = url.compare(0, 6, "wss://") == 0;
+		if (!endpoint_ || endpoint_->Secure() != secure ||
+		    endpoint_->Compressed() != compression_ ||
+		    (secure && tls_changed_)) {
+			tls_changed_ = false;
+			endpoint_ = CreateEndpoint(this, secure, compression_,
+						   tls_options_);
+			if (!endpoint_)
+				return;
+		}
 
-		client_.connect(conn);
-	} catch (const std::exception &e) {
-		blog(LOG_DEBUG, "%s", e.what());
-	} catch (websocketpp::lib::error_code e) {
-		blog(LOG_DEBUG, "%s", e.message().c_str());
-	} catch (...) {
-		blog(LOG_DEBUG, "other exception");
-	}
+		try {
+			endpoint_->Connect(url, hdl_);
+		} catch (const std::exception &e) {
+			blog(LOG_DEBUG, "%s", e.what());
+		} catch (websocketpp::lib::error_code e) {
+			blog(LOG_DEBUG, "%s", e.message().c_str());
+		} catch (...) {
+			blog(LOG_DEBUG, "other exception");
+		}
+	});
 }
 
 void WebsocketClient::Close(websocketpp::close::status::value code,
 			    const std::string &reason)
 {
+	// queued on the strand so the messages sent before are flushed first,
+	// closed by the drain once they are all out
+	strand_->post([this, self = shared_from_this(), code, reason]() {
+		// already closed by the detach
+		if (detached_)
+			return;
+		close_pending_ = true;
+		close_code_ = code;
+		close_reason_ = reason;
+		DrainQueue();
+	});
+}
+
+void WebsocketClient::FinishClose()
+{
+	if (!close_pending_)
+		return;
+	close_pending_ = false;
+
+	if (!endpoint_)
+		return;
 	try {
-		client_.close(hdl_, code, reason);
+		endpoint_->Close(hdl_, close_code_, close_reason_);
 	} catch (const std::exception &e) {
 		blog(LOG_DEBUG, "%s", e.what());
 	} catch (websocketpp::lib::error_code e) {
@@ -95,29 +474,171 @@ void WebsocketClient::Close(websocketpp::close::status::value code,
 	}
 }
 
-void WebsocketClient::SendMsg(const std::string &msg)
+bool WebsocketClient::SendMsg(const std::string &msg,
+			      MessagePriority priority, bool droppable)
 {
-	blog(LOG_DEBUG, "\n>>>>>>>>>>>>>>>>>>>>>>>>>\n%s", msg.c_str());
-	client_.send(hdl_, msg, websocketpp::frame::opcode::text);
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex_);
+
+		// identical messages(keep-alive) still waiting are coalesced
+		auto &queue = priority == MessagePriority::kNormal
+				      ? normal_queue_
+				      : high_queue_;
+		if (priority != MessagePriority::kFirst && !queue.empty() &&
+		    queue.back().msg == msg)
+			return true;
+
+		// make room at the cost of stale trickles & keep-alives, the
+		// session setup is never dropped
+		while ((priority != MessagePriority::kNormal || !droppable) &&
+		       QueueFull(msg.size()) && DropStale()) {
+		}
+
+		if (QueueFull(msg.size())) {
+			blog(LOG_WARNING,
+			     "outbound queue full(%zu bytes), message dropped",
+			     queued_bytes_);
+			return false;
+		}
+
+		blog(LOG_DEBUG, "\n>>>>>>>>>>>>>>>>>>>>>>>>>\n%s", msg.c_str());
+		if (priority == MessagePriority::kFirst)
+			queue.push_front({msg, droppable});
+		else
+			queue.push_back({msg, droppable});
+		queued_bytes_ += msg.size();
+	}
+
+	ScheduleDrain();
+	return true;
+}
+
+bool WebsocketClient::QueueFull(size_t bytes) const
+{
+	return high_queue_.size() + normal_queue_.size() >=
+		       kMaxQueuedMessages ||
+	       queued_bytes_ + bytes > kMaxQueuedBytes;
+}
+
+bool WebsocketClient::DropStale()
+{
+	// the oldest keep-alive first, then the oldest trickle
+	for (auto queue : {&normal_queue_, &high_queue_}) {
+		for (auto it = queue->begin(); it != queue->end(); ++it) {
+			if (!it->droppable)
+				continue;
+			queued_bytes_ -= it->msg.size();
+			queue->erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+void WebsocketClient::DropAllStale()
+{
+	std::lock_guard<std::mutex> lock(queue_mutex_);
+	while (DropStale()) {
+	}
+}
+
+void WebsocketClient::ScheduleDrain()
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex_);
+		if (drain_scheduled_)
+			return;
+		drain_scheduled_ = true;
+	}
+	// nothing to do if we are going away, the detach flushes the queue
+	auto self = weak_from_this().lock();
+	if (self == nullptr)
+		return;
+	strand_->post([this, self]() { DrainQueue(); });
+}
+
+void WebsocketClient::DrainQueue(bool flush)
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex_);
+		drain_scheduled_ = false;
+	}
+
+	// messages stay queued until the connection is opened
+	if (detached_ || !connected_ || !endpoint_) {
+		FinishClose();
+		return;
+	}
+
+	// hand everything queued to websocketpp in one go, it gathers the
+	// frames into as few socket writes as possible
+	while (true) {
+		if (!flush &&
+		    endpoint_->BufferedAmount(hdl_) > kMaxBufferedBytes) {
+			// slow link, try again later
+			auto self = weak_from_this().lock();
+			if (self == nullptr)
+				return;
+			drain_timer_->expires_from_now(
+				std::chrono::milliseconds(kDrainRetryMs));
+			drain_timer_->async_wait(strand_->wrap(
+				[this, self](const websocketpp::lib::asio::
+						     error_code &e) {
+					if (e)
+						return;
+					DrainQueue();
+				}));
+			return;
+		}
+
+		std::string msg;
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex_);
+			auto &queue = !high_queue_.empty() ? high_queue_
+							   : normal_queue_;
+			if (queue.empty())
+				break;
+			msg = std::move(queue.front().msg);
+			queue.pop_front();
+			queued_bytes_ -= msg.size();
+		}
+
+		auto ec = endpoint_->Send(hdl_, msg);
+		if (ec) {
+			blog(LOG_WARNING, "send message failed: %s",
+			     ec.message().c_str());
+		}
+	}
+	FinishClose();
+}
+
+void WebsocketClient::ClearQueue()
+{
+	std::lock_guard<std::mutex> lock(queue_mutex_);
+	high_queue_.clear();
+	normal_queue_.clear();
+	queued_bytes_ = 0;
 }
 
 void WebsocketClient::OnConnectionOpen()
 {
 	blog(LOG_DEBUG, "Connection opened");
 	connected_ = true;
+	endpoint_->OnOpened(hdl_);
+	// trickles & keep-alives queued while down belong to the old socket,
+	// the session is claimed first
+	DropAllStale();
 	observer_->OnConnected();
+	// send what was queued while connecting
+	ScheduleDrain();
 }
 
 void WebsocketClient::OnConnectionFail()
 {
 	connected_ = false;
-	IWebsocketClient::connection_ptr con = client_.get_con_from_hdl(hdl_);
+	ClearQueue();
 
-	std::string server = con->get_response_header("Server");
-	std::string error_reason = con->get_ec().message();
-
-	blog(LOG_DEBUG, "connection failed, server info: %s, reason: %s",
-	     server.c_str(), error_reason.c_str());
+	std::string error_reason = endpoint_->FailReason(hdl_);
 	if (observer_)
 		observer_->OnConnectionClosed(error_reason);
 }
@@ -125,19 +646,17 @@ void WebsocketClient::OnConnectionFail()
 void WebsocketClient::OnConnectionClose()
 {
 	connected_ = false;
-	IWebsocketClient::connection_ptr con = client_.get_con_from_hdl(hdl_);
-	std::stringstream s;
-	s << "close code: " << con->get_remote_close_code() << " ("
-	  << websocketpp::close::status::get_string(
-		     con->get_remote_close_code())
-	  << "), close reason: " << con->get_remote_close_reason();
-	blog(LOG_DEBUG, "%s", s.str().c_str());
+	// the pending messages belong to the old connection
+	ClearQueue();
+
+	std::string reason = endpoint_->CloseReason(hdl_);
+	blog(LOG_DEBUG, "%s", reason.c_str());
 	if (observer_)
-		observer_->OnConnectionClosed(s.str());
+		observer_->OnConnectionClosed(reason);
 }
 
 void WebsocketClient::OnRecvMsg(websocketpp::connection_hdl hdl,
-				IWebsocketClient::message_ptr msg)
+				IWebsocketMessagePtr msg)
 {
 	if (msg->get_opcode() == websocketpp::frame::opcode::text) {
 		blog(LOG_DEBUG, "\n<<<<<<<<<<<<<<<<<<<<<<<<<\n%s",
@@ -1,11 +1,18 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <memory>
+#include <mutex>
 
+#include "io_context_pool.h"
+#include "deflate_extension.h"
 #include "websocketpp/client.hpp"
 #include "websocketpp/config/asio_no_tls_client.hpp"
 
 typedef websocketpp::client<websocketpp::config::asio_client> IWebsocketClient;
+// the message type is the same for the ws:// and wss:// clients
+typedef websocketpp::config::asio_client::message_type::ptr IWebsocketMessagePtr;
 
 namespace janus::signaling {
 class WebsocketClientInterface {
@@ -15,7 +22,27 @@ public:
 	virtual void OnRecvMessage(const std::string &msg) = 0;
 };
 
-class WebsocketClient {
+// messages of higher priority skip ahead of the queued normal ones
+enum class MessagePriority {
+	kFirst = 0, // ahead of everything queued, the claim after a reconnect
+	kHigh,      // trickle, configure/offer...
+	kNormal,    // keep-alive and the rest
+};
+
+// options for wss:// connections
+struct TlsOptions {
+	// verify the server certificate & host name
+	bool verify_peer = true;
+	// extra CA bundle(PEM), e.g. for a self-signed janus deployment
+	std::string ca_file;
+};
+
+// the websocketpp client of one scheme(ws:// or wss://)
+class WebsocketEndpoint;
+
+// create with `std::make_shared`, the work it posts to the io thread keeps
+// it alive
+class WebsocketClient : public std::enable_shared_from_this<WebsocketClient> {
 public:
 	WebsocketClient();
 	~WebsocketClient();
@@ -24,27 +51,89 @@ public:
 	bool Connected() const;
 
 	void AddObserver(WebsocketClientInterface *observer);
+	// takes effect on the next `Connect()`
+	void SetTlsOptions(const TlsOptions &options);
+	// negotiate permessage-deflate with `options`, takes effect on the next
+	// `Connect()`
+	void SetCompression(bool enabled, const DeflateOptions &options);
+	// the bytes of this client before & after compression
+	DeflateStats CompressionStats() const;
 
 	void Connect(const std::string &url);
 	void Close(websocketpp::close::status::value code =
 			   websocketpp::close::status::normal,
 		   const std::string &reason = "");
-	void SendMsg(const std::string &msg);
+	// thread safe, queue the message & send it on the io thread,
+	// returns false if it was dropped because the queue is full,
+	// `droppable` ones(trickle, keep-alive) make room for the others when
+	// it is & are dropped once the socket reopens, they are stale by then
+	bool SendMsg(const std::string &msg,
+		     MessagePriority priority = MessagePriority::kNormal,
+		     bool droppable = false);
+	// drop everything queued, e.g. the session it was meant for is gone
+	void ClearQueue();
+	// no more calls into the observer once it returns, what is queued is
+	// flushed & the connection closed, the client is done with after this
+	void Detach();
 
 private:
-	IWebsocketClient client_;
+	template<typename Endpoint> friend class EndpointImpl;
+
+	// the shared io_service this connection runs on, declared first so it
+	// goes last, & a strand for our own work posted to it
+	std::shared_ptr<IoContextPool::IoService> io_service_;
+	std::unique_ptr<IoContextPool::IoService::strand> strand_;
+
+	// also kept by its connections until they are closed
+	std::shared_ptr<WebsocketEndpoint> endpoint_;
 	WebsocketClientInterface *observer_;
 	websocketpp::connection_hdl hdl_;
-	websocketpp::lib::shared_ptr<websocketpp::lib::thread> thread_;
+	TlsOptions tls_options_;
+	// set since the tls endpoint was created, touched on the strand only
+	bool tls_changed_;
+	bool compression_;
+	DeflateOptions deflate_options_;
+	std::shared_ptr<DeflateCounters> deflate_counters_;
 
 	std::string url_;
-	bool connected_;
+	std::atomic<bool> connected_;
+
+	struct Outbound {
+		std::string msg;
+		bool droppable;
+	};
+
+	// outbound messages, written by any thread & drained on the io thread
+	std::mutex queue_mutex_;
+	std::deque<Outbound> high_queue_;
+	std::deque<Outbound> normal_queue_;
+	size_t queued_bytes_;
+	bool drain_scheduled_;
+	bool detached_;
+	// retry draining when the socket has too much data in flight
+	std::unique_ptr<websocketpp::lib::asio::steady_timer> drain_timer_;
+	// `Close()` waits for the queue to drain, touched on the strand only
+	bool close_pending_;
+	websocketpp::close::status::value close_code_;
+	std::string close_reason_;
+
+	void ScheduleDrain();
+	// `flush` ignores the data in flight, the last chance to send
+	void DrainQueue(bool flush = false);
+	// call with `queue_mutex_` held
+	bool QueueFull(size_t bytes) const;
+	bool DropStale();
+	void DropAllStale();
+	// close once the queue is drained
+	void FinishClose();
+	// stop the current connection & any of its handlers calling back
+	// into `this`
+	void RetireConnection();
 
 	void OnConnectionOpen();
 	void OnConnectionFail();
 	void OnConnectionClose();
 
-	void OnRecvMsg(websocketpp::connection_hdl hdl,
-		       IWebsocketClient::message_ptr msg);
+	void OnRecvMsg(websocketpp::connection_hdl hdl, IWebsocketMessagePtr msg);
 };
 } // namespace teleport::signaling
@@ -0,0 +1,49 @@
+#include "backoff.h"
+
+#include <gtest/gtest.h>
+
+using janus::Backoff;
+
+TEST(Backoff, GrowsWithinTheJitterUpToTheCap)
+{
+	Backoff backoff(100, 1000, 2.0, 0.3, 0);
+	for (uint32_t attempt = 0; attempt < 8; attempt++) {
+		double base = std::min(100.0 * (1u << attempt), 1000.0);
+		uint32_t delay = backoff.NextDelay();
+		EXPECT_GE(delay, (uint32_t)(base * 0.7) - 1) << attempt;
+		EXPECT_LE(delay, (uint32_t)(base * 1.3) + 1) << attempt;
+	}
+	EXPECT_EQ(backoff.Attempts(), 8u);
+}
+
+TEST(Backoff, NoJitterIsExact)
+{
+	Backoff backoff(500, 30 * 1000, 2.0, 0.0, 0);
+	EXPECT_EQ(backoff.NextDelay(), 500u);
+	EXPECT_EQ(backoff.NextDelay(), 1000u);
+	EXPECT_EQ(backoff.NextDelay(), 2000u);
+}
+
+TEST(Backoff, ExhaustedAfterTheLastAttempt)
+{
+	Backoff backoff(10, 100, 2.0, 0.0, 3);
+	for (int i = 0; i < 3; i++) {
+		EXPECT_FALSE(backoff.Exhausted());
+		backoff.NextDelay();
+	}
+	EXPECT_TRUE(backoff.Exhausted());
+
+	backoff.Reset();
+	EXPECT_FALSE(backoff.Exhausted());
+	EXPECT_EQ(backoff.Attempts(), 0u);
+	// starts over from the initial delay
+	EXPECT_EQ(backoff.NextDelay(), 10u);
+}
+
+TEST(Backoff, ZeroAttemptsNeverExhausts)
+{
+	Backoff backoff(1, 2, 2.0, 0.0, 0);
+	for (int i = 0; i < 100; i++)
+		backoff.NextDelay();
+	EXPECT_FALSE(backoff.Exhausted());
+}
@@ -0,0 +1,89 @@
+#include "epoch_ptr.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using janus::EpochPtr;
+
+namespace {
+struct Value {
+	explicit Value(int v) : value(v), alive(true) {}
+	~Value() { alive = false; }
+	int value;
+	std::atomic<bool> alive;
+};
+} // namespace
+
+TEST(EpochPtr, ExchangeHandsBackThePreviousValue)
+{
+	EpochPtr<Value> ptr;
+	EXPECT_FALSE(ptr.Read());
+
+	Value a(1), b(2);
+	EXPECT_EQ(ptr.Exchange(&a), nullptr);
+	EXPECT_EQ(ptr.Read()->value, 1);
+	EXPECT_EQ(ptr.Exchange(&b), &a);
+	EXPECT_EQ(ptr.Read()->value, 2);
+	EXPECT_EQ(ptr.Exchange(nullptr), &b);
+	EXPECT_FALSE(ptr.Read());
+}
+
+TEST(EpochPtr, ExchangeWaitsForTheReaders)
+{
+	EpochPtr<Value> ptr;
+	Value a(1), b(2);
+	ptr.Exchange(&a);
+
+	std::atomic<bool> exchanged(false);
+	std::thread writer;
+	{
+		auto guard = ptr.Read();
+		writer = std::thread([&]() {
+			ptr.Exchange(&b);
+			exchanged = true;
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		// still reading the old value
+		EXPECT_FALSE(exchanged);
+		EXPECT_EQ(guard->value, 1);
+	}
+	writer.join();
+	EXPECT_TRUE(exchanged);
+
+	// the readers after the flip do not hold the writer up
+	auto guard = ptr.Read();
+	EXPECT_EQ(guard->value, 2);
+}
+
+TEST(EpochPtr, NoReaderSeesAReleasedValue)
+{
+	EpochPtr<Value> ptr;
+	ptr.Exchange(new Value(0));
+
+	std::atomic<bool> done(false);
+	std::atomic<int> released_reads(0);
+	std::vector<std::thread> readers;
+	for (int i = 0; i < 4; i++) {
+		readers.emplace_back([&]() {
+			while (!done) {
+				auto guard = ptr.Read();
+				if (guard && !guard->alive)
+					released_reads++;
+			}
+		});
+	}
+
+	for (int i = 1; i <= 2000; i++)
+		delete ptr.Exchange(new Value(i));
+
+	done = true;
+	for (auto &reader : readers)
+		reader.join();
+	delete ptr.Exchange(nullptr);
+
+	EXPECT_EQ(released_reads, 0);
+}
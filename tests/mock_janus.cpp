@@ -0,0 +1,58 @@
+#include "mock_janus.h"
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+namespace janus::test {
+
+static std::string ReadBio(BIO *bio)
+{
+	char *data = nullptr;
+	long size = BIO_get_mem_data(bio, &data);
+	return std::string(data, size > 0 ? (size_t)size : 0);
+}
+
+bool MakeSelfSignedCertificate(std::string &cert, std::string &key)
+{
+	EVP_PKEY *pkey = nullptr;
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr);
+	bool ok = ctx != nullptr && EVP_PKEY_keygen_init(ctx) > 0 &&
+		  EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) > 0 &&
+		  EVP_PKEY_keygen(ctx, &pkey) > 0;
+	EVP_PKEY_CTX_free(ctx);
+	if (!ok)
+		return false;
+
+	X509 *x509 = X509_new();
+	X509_set_version(x509, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 24 * 3600);
+	X509_set_pubkey(x509, pkey);
+	X509_NAME *name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+				   (const unsigned char *)"localhost", -1, -1,
+				   0);
+	X509_set_issuer_name(x509, name);
+	ok = X509_sign(x509, pkey, EVP_sha256()) > 0;
+
+	BIO *cert_bio = BIO_new(BIO_s_mem());
+	BIO *key_bio = BIO_new(BIO_s_mem());
+	ok = ok && PEM_write_bio_X509(cert_bio, x509) > 0 &&
+	     PEM_write_bio_PrivateKey(key_bio, pkey, nullptr, nullptr, 0,
+				      nullptr, nullptr) > 0;
+	if (ok) {
+		cert = ReadBio(cert_bio);
+		key = ReadBio(key_bio);
+	}
+
+	BIO_free(cert_bio);
+	BIO_free(key_bio);
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+	return ok;
+}
+
+} // namespace janus::test
@@ -0,0 +1,425 @@
+#pragma once
+
+// a scripted stand-in for a janus server with the videoroom plugin, enough
+// of the websocket api for the publish flows of the plugin: create, attach,
+// claim, keepalive, trickle & the joinandconfigure/configure/unpublish
+// requests of the videoroom, the answer mirrors the offer so the signaling
+// completes but no media flows, see `mock_janus_main.cpp` to run it against
+// obs
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "websocketpp/config/asio.hpp"
+#include "websocketpp/server.hpp"
+
+namespace janus::test {
+
+struct MockJanusOptions {
+	// 0 picks a free one, see `MockJanus::Port()`
+	uint16_t port = 0;
+	// added before every reply, a far away server
+	uint32_t rtt_ms = 0;
+	// the pin of the rooms, a join with another one is rejected
+	std::string pin;
+	// sessions are gone after a disconnect, the claim fails & the plugin
+	// joins again
+	bool forget_sessions = false;
+	// drop every connection that long after a publish joined, a server
+	// going down, 0 never
+	uint32_t drop_after_join_ms = 0;
+	// wss:// with this certificate & key(PEM)
+	std::string tls_cert;
+	std::string tls_key;
+};
+
+// the mirrored answer of `offer`: we receive what it sends
+inline std::string MockAnswer(const std::string &offer)
+{
+	auto replace = [](std::string sdp, const std::string &from,
+			  const std::string &to) {
+		for (size_t pos = sdp.find(from); pos != std::string::npos;
+		     pos = sdp.find(from, pos + to.size()))
+			sdp.replace(pos, from.size(), to);
+		return sdp;
+	};
+	std::string answer =
+		replace(offer, "a=setup:actpass", "a=setup:passive");
+	answer = replace(answer, "a=sendrecv", "a=recvonly");
+	return replace(answer, "a=sendonly", "a=recvonly");
+}
+
+inline bool SessionReused(
+	websocketpp::server<websocketpp::config::asio>::connection_ptr)
+{
+	return false;
+}
+
+inline bool SessionReused(
+	websocketpp::server<websocketpp::config::asio_tls>::connection_ptr con)
+{
+	return SSL_session_reused(con->get_socket().native_handle()) == 1;
+}
+
+// `Config` is websocketpp::config::asio or asio_tls
+template<typename Config> class MockJanus {
+public:
+	typedef websocketpp::server<Config> Server;
+	typedef websocketpp::lib::asio::ssl::context SslContext;
+
+	explicit MockJanus(const MockJanusOptions &options)
+		: options_(options), next_id_(1000), resumed_(0), opened_(0)
+	{
+		server_.clear_access_channels(websocketpp::log::alevel::all);
+		server_.clear_error_channels(websocketpp::log::elevel::all);
+		server_.init_asio();
+		server_.set_reuse_addr(true);
+
+		server_.set_validate_handler(
+			[this](websocketpp::connection_hdl hdl) {
+				return OnValidate(hdl);
+			});
+		server_.set_open_handler(
+			[this](websocketpp::connection_hdl hdl) {
+				OnOpen(hdl);
+			});
+		server_.set_close_handler(
+			[this](websocketpp::connection_hdl hdl) {
+				OnClose(hdl);
+			});
+		server_.set_message_handler(
+			[this](websocketpp::connection_hdl hdl,
+			       typename Server::message_ptr msg) {
+				OnMessage(hdl, msg->get_payload());
+			});
+	}
+
+	~MockJanus() { Stop(); }
+
+	// wss:// only, with `tls_cert` & `tls_key` of the options
+	void UseTls()
+	{
+		auto context = websocketpp::lib::make_shared<SslContext>(
+			SslContext::tls_server);
+		context->use_certificate_chain(websocketpp::lib::asio::buffer(
+			options_.tls_cert));
+		context->use_private_key(
+			websocketpp::lib::asio::buffer(options_.tls_key),
+			SslContext::pem);
+		// one context for all the connections, the session tickets of
+		// one resume on the next
+		server_.set_tls_init_handler(
+			[context](websocketpp::connection_hdl) {
+				return context;
+			});
+	}
+
+	void Start()
+	{
+		server_.listen(websocketpp::lib::asio::ip::tcp::v4(),
+			       options_.port);
+		server_.start_accept();
+		websocketpp::lib::asio::error_code ec;
+		port_ = server_.get_local_endpoint(ec).port();
+		thread_ = std::thread([this]() { server_.run(); });
+	}
+
+	void Stop()
+	{
+		if (!thread_.joinable())
+			return;
+		server_.get_io_service().post([this]() {
+			websocketpp::lib::error_code ec;
+			server_.stop_listening(ec);
+			DropConnections();
+			server_.stop();
+		});
+		thread_.join();
+	}
+
+	uint16_t Port() const { return port_; }
+
+	// abort every connection without a close handshake, a crash
+	void DropAll()
+	{
+		server_.get_io_service().post([this]() { DropConnections(); });
+	}
+
+	// "create", "attach", "claim", "joinandconfigure"... in arrival order
+	std::vector<std::string> Requests() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return requests_;
+	}
+	// the tls handshakes which resumed a session
+	uint32_t Resumed() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return resumed_;
+	}
+	uint32_t Opened() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return opened_;
+	}
+
+	// called on the server thread
+	std::function<void(const std::string &line)> log;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// a session & the publish on it
+	struct Session {
+		std::set<uint64_t> handles;
+		Clock::time_point created;
+		uint32_t requests = 0;
+	};
+
+	MockJanusOptions options_;
+	Server server_;
+	std::thread thread_;
+	uint16_t port_ = 0;
+
+	mutable std::mutex mutex_;
+	std::set<websocketpp::connection_hdl,
+		 std::owner_less<websocketpp::connection_hdl>>
+		connections_;
+	std::map<uint64_t, Session> sessions_;
+	uint64_t next_id_;
+	std::vector<std::string> requests_;
+	uint32_t resumed_;
+	uint32_t opened_;
+
+	// on the server thread
+	void DropConnections()
+	{
+		std::set<websocketpp::connection_hdl,
+			 std::owner_less<websocketpp::connection_hdl>>
+			connections;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			connections.swap(connections_);
+		}
+		for (auto &hdl : connections) {
+			websocketpp::lib::error_code ec;
+			auto con = server_.get_con_from_hdl(hdl, ec);
+			if (!ec)
+				con->terminate(ec);
+		}
+	}
+
+	void Log(const std::string &line)
+	{
+		if (log)
+			log(line);
+	}
+
+	bool OnValidate(websocketpp::connection_hdl hdl)
+	{
+		// the plugin asks for janus' subprotocol
+		auto con = server_.get_con_from_hdl(hdl);
+		for (auto &protocol : con->get_requested_subprotocols()) {
+			if (protocol == "janus-protocol")
+				con->select_subprotocol(protocol);
+		}
+		return true;
+	}
+
+	void OnOpen(websocketpp::connection_hdl hdl)
+	{
+		bool resumed = SessionReused(server_.get_con_from_hdl(hdl));
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			connections_.insert(hdl);
+			opened_++;
+			if (resumed)
+				resumed_++;
+		}
+		Log(std::string("connection opened") +
+		    (resumed ? ", tls session resumed" : ""));
+	}
+
+	void OnClose(websocketpp::connection_hdl hdl)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			connections_.erase(hdl);
+			if (options_.forget_sessions)
+				sessions_.clear();
+		}
+		Log("connection closed");
+	}
+
+	void OnMessage(websocketpp::connection_hdl hdl, const std::string &text)
+	{
+		auto json = nlohmann::json::parse(text, nullptr, false);
+		if (json.is_discarded() || !json.is_object())
+			return;
+
+		std::string janus = json.value("janus", "");
+		std::string transaction = json.value("transaction", "");
+		uint64_t session_id = json.value("session_id", (uint64_t)0);
+		std::string request = janus;
+		if (janus == "message" && json.contains("body") &&
+		    json["body"].is_object())
+			request = json["body"].value("request", janus);
+		Log("<< " + request);
+
+		nlohmann::json reply = {{"transaction", transaction}};
+		std::unique_lock<std::mutex> lock(mutex_);
+		requests_.push_back(request);
+		auto session = sessions_.find(session_id);
+		if (session != sessions_.end())
+			session->second.requests++;
+
+		if (janus == "create") {
+			uint64_t id = next_id_++;
+			sessions_[id].created = Clock::now();
+			sessions_[id].requests = 1;
+			reply["janus"] = "success";
+			reply["data"] = {{"id", id}};
+		} else if (janus == "claim") {
+			if (session != sessions_.end())
+				reply["janus"] = "success";
+			else
+				reply = NoSuchSession(transaction);
+		} else if (session == sessions_.end()) {
+			reply = NoSuchSession(transaction);
+		} else if (janus == "attach") {
+			uint64_t id = next_id_++;
+			session->second.handles.insert(id);
+			reply["janus"] = "success";
+			reply["session_id"] = session_id;
+			reply["data"] = {{"id", id}};
+		} else if (janus == "message") {
+			// the plugin acks first, the event follows
+			Reply(hdl, {{"janus", "ack"},
+				    {"transaction", transaction},
+				    {"session_id", session_id}});
+			reply = PluginEvent(json, request, session->second);
+			reply["transaction"] = transaction;
+			reply["session_id"] = session_id;
+		} else {
+			// keepalive, trickle, detach...
+			reply["janus"] = "ack";
+			reply["session_id"] = session_id;
+		}
+		lock.unlock();
+		Reply(hdl, reply);
+	}
+
+	static nlohmann::json NoSuchSession(const std::string &transaction)
+	{
+		return {{"janus", "error"},
+			{"transaction", transaction},
+			{"error",
+			 {{"code", 458}, {"reason", "No such session"}}}};
+	}
+
+	// call with `mutex_` held
+	nlohmann::json PluginEvent(const nlohmann::json &json,
+				   const std::string &request,
+				   const Session &session)
+	{
+		auto body = json.value("body", nlohmann::json::object());
+		nlohmann::json data = {{"videoroom", "event"}};
+		nlohmann::json event = {
+			{"janus", "event"},
+			{"sender", json.value("handle_id", (uint64_t)0)}};
+
+		if (request == "joinandconfigure" && !options_.pin.empty() &&
+		    body.value("pin", "") != options_.pin) {
+			data["error_code"] = 433;
+			data["error"] = "Unauthorized (wrong pin)";
+		} else if (request == "joinandconfigure" ||
+			   request == "configure" || request == "publish") {
+			if (request == "joinandconfigure") {
+				data["videoroom"] = "joined";
+				data["room"] = body.value("room", (uint64_t)0);
+				data["id"] = body.value("id", (uint64_t)0);
+			}
+			data["configured"] = "ok";
+			auto jsep = json.value("jsep", nlohmann::json());
+			if (jsep.is_object()) {
+				std::string offer = jsep.value("sdp", "");
+				event["jsep"] = {{"type", "answer"},
+						 {"sdp", MockAnswer(offer)}};
+			}
+			if (request == "joinandconfigure")
+				OnJoined(session);
+		} else if (request == "unpublish") {
+			data["unpublished"] = "ok";
+		}
+		event["plugindata"] = {{"plugin", "janus.plugin.videoroom"},
+				       {"data", data}};
+		return event;
+	}
+
+	// call with `mutex_` held
+	void OnJoined(const Session &session)
+	{
+		auto elapsed = std::chrono::duration_cast<
+			std::chrono::milliseconds>(Clock::now() -
+						   session.created);
+		Log("joined after " + std::to_string(session.requests) +
+		    " requests, " + std::to_string(elapsed.count()) +
+		    " ms after create");
+
+		if (options_.drop_after_join_ms == 0)
+			return;
+		auto timer = std::make_shared<
+			websocketpp::lib::asio::steady_timer>(
+			server_.get_io_service(),
+			std::chrono::milliseconds(options_.drop_after_join_ms));
+		timer->async_wait(
+			[this, timer](const websocketpp::lib::asio::error_code
+					      &e) {
+				if (e)
+					return;
+				Log("dropping every connection");
+				DropConnections();
+			});
+	}
+
+	void Reply(websocketpp::connection_hdl hdl, const nlohmann::json &json)
+	{
+		std::string text = json.dump();
+		auto send = [this, hdl, text]() {
+			websocketpp::lib::error_code ec;
+			server_.send(hdl, text,
+				     websocketpp::frame::opcode::text, ec);
+		};
+		if (options_.rtt_ms == 0) {
+			send();
+			return;
+		}
+
+		// the whole round trip on the way back, in order
+		auto timer = std::make_shared<
+			websocketpp::lib::asio::steady_timer>(
+			server_.get_io_service(),
+			std::chrono::milliseconds(options_.rtt_ms));
+		timer->async_wait(
+			[timer, send](const websocketpp::lib::asio::error_code
+					      &e) {
+				if (!e)
+					send();
+			});
+	}
+};
+
+// a self-signed certificate for "localhost" & its key, PEM
+bool MakeSelfSignedCertificate(std::string &cert, std::string &key);
+
+} // namespace janus::test
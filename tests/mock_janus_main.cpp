@@ -0,0 +1,108 @@
+// the mock janus on its own, for the flows that need obs & libwebrtc:
+//
+//   mock-janus --port 8188 --rtt 150
+//     point the plugin at ws://127.0.0.1:8188 & start streaming, each join
+//     logs the requests it took & how long since the connection opened,
+//     the setup time of a far away server
+//
+//   mock-janus --port 8188 --drop-after-join 5000
+//   mock-janus --port 8189
+//     the first as the primary & the second as the standby of the
+//     failover, the primary drops 5s after the join & the publish moves
+//
+//   mock-janus --tls --forget-sessions
+//     wss:// with a self-signed certificate(set the plugin to not verify
+//     it), the reconnects resume the tls session & have to join again
+//
+// stop it with ctrl-c
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+#include "mock_janus.h"
+
+using namespace janus::test;
+
+static std::atomic<bool> running{true};
+
+static void OnSignal(int)
+{
+	running = false;
+}
+
+static void Usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [--port N] [--rtt MS] [--pin PIN] "
+		"[--forget-sessions]\n"
+		"       [--drop-after-join MS] [--tls]\n",
+		name);
+}
+
+template<typename Config> static int Run(const MockJanusOptions &options)
+{
+	MockJanus<Config> mock(options);
+	mock.log = [](const std::string &line) {
+		printf("%s\n", line.c_str());
+		fflush(stdout);
+	};
+	if constexpr (std::is_same_v<Config, websocketpp::config::asio_tls>)
+		mock.UseTls();
+	mock.Start();
+	printf("listening on %s://127.0.0.1:%u\n",
+	       options.tls_cert.empty() ? "ws" : "wss", mock.Port());
+	fflush(stdout);
+
+	while (running)
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	mock.Stop();
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	MockJanusOptions options;
+	bool tls = false;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (strcmp(arg, "--tls") == 0) {
+			tls = true;
+		} else if (strcmp(arg, "--forget-sessions") == 0) {
+			options.forget_sessions = true;
+		} else if (value && strcmp(arg, "--port") == 0) {
+			options.port = (uint16_t)atoi(value);
+			i++;
+		} else if (value && strcmp(arg, "--rtt") == 0) {
+			options.rtt_ms = (uint32_t)atoi(value);
+			i++;
+		} else if (value && strcmp(arg, "--pin") == 0) {
+			options.pin = value;
+			i++;
+		} else if (value && strcmp(arg, "--drop-after-join") == 0) {
+			options.drop_after_join_ms = (uint32_t)atoi(value);
+			i++;
+		} else {
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+
+	if (!tls)
+		return Run<websocketpp::config::asio>(options);
+
+	if (!MakeSelfSignedCertificate(options.tls_cert, options.tls_key)) {
+		fprintf(stderr, "failed to make the certificate\n");
+		return 1;
+	}
+	return Run<websocketpp::config::asio_tls>(options);
+}
@@ -0,0 +1,162 @@
+#include "sdp_munger.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+using janus::rtc::MungeLocalOffer;
+using janus::rtc::MungeRemoteAnswer;
+using janus::rtc::SdpDocument;
+using janus::rtc::SdpMungeOptions;
+
+namespace {
+// the shape of a libwebrtc offer, trimmed
+const char *kOffer = "v=0\r\n"
+		     "o=- 1 2 IN IP4 127.0.0.1\r\n"
+		     "s=-\r\n"
+		     "t=0 0\r\n"
+		     "a=group:BUNDLE 0 1\r\n"
+		     "m=audio 9 UDP/TLS/RTP/SAVPF 111 63\r\n"
+		     "c=IN IP4 0.0.0.0\r\n"
+		     "a=mid:0\r\n"
+		     "a=rtpmap:111 opus/48000/2\r\n"
+		     "a=rtcp-fb:111 transport-cc\r\n"
+		     "a=fmtp:111 minptime=10\r\n"
+		     "a=rtpmap:63 red/48000/2\r\n"
+		     "a=fmtp:63 111/111\r\n"
+		     "m=video 9 UDP/TLS/RTP/SAVPF 96 97 98 99 100\r\n"
+		     "c=IN IP4 0.0.0.0\r\n"
+		     "a=mid:1\r\n"
+		     "a=rtpmap:96 VP8/90000\r\n"
+		     "a=rtcp-fb:96 nack\r\n"
+		     "a=rtcp-fb:96 nack pli\r\n"
+		     "a=rtpmap:97 rtx/90000\r\n"
+		     "a=fmtp:97 apt=96\r\n"
+		     "a=rtpmap:98 H264/90000\r\n"
+		     "a=rtcp-fb:98 nack\r\n"
+		     "a=fmtp:98 profile-level-id=42e01f\r\n"
+		     "a=rtpmap:99 rtx/90000\r\n"
+		     "a=fmtp:99 apt=98\r\n"
+		     "a=rtpmap:100 ulpfec/90000\r\n"
+		     "a=ssrc-group:FID 1111 2222\r\n"
+		     "a=ssrc:1111 cname:obs\r\n"
+		     "a=ssrc:2222 cname:obs\r\n";
+
+SdpDocument::Media Section(const std::string &sdp, const std::string &kind)
+{
+	SdpDocument doc(sdp);
+	auto it = std::find_if(doc.media.begin(), doc.media.end(),
+			       [&kind](const SdpDocument::Media &m) {
+				       return m.kind == kind;
+			       });
+	EXPECT_NE(it, doc.media.end()) << kind;
+	return it != doc.media.end() ? *it : SdpDocument::Media();
+}
+
+bool HasLine(const SdpDocument::Media &m, const std::string &line)
+{
+	return std::find(m.lines.begin(), m.lines.end(), line) !=
+	       m.lines.end();
+}
+} // namespace
+
+TEST(SdpDocument, RoundTripsUntouched)
+{
+	SdpDocument doc(kOffer);
+	EXPECT_EQ(doc.ToString(), kOffer);
+	ASSERT_EQ(doc.media.size(), 2u);
+	EXPECT_EQ(doc.media[0].kind, "audio");
+	EXPECT_EQ(doc.media[1].CodecName("98"), "H264");
+	EXPECT_EQ(doc.media[1].Fmtp("97"), "apt=96");
+	EXPECT_EQ(doc.media[1].PayloadTypes(),
+		  (std::vector<std::string>{"96", "97", "98", "99", "100"}));
+}
+
+TEST(MungeLocalOffer, DefaultsKeepTheOffer)
+{
+	SdpMungeOptions options;
+	options.opus_fec = false;
+	EXPECT_EQ(MungeLocalOffer(kOffer, options), kOffer);
+}
+
+TEST(MungeLocalOffer, PrefersTheListedCodecs)
+{
+	SdpMungeOptions options;
+	options.video_codecs = {"H264/profile-level-id=42e01f"};
+	auto video = Section(MungeLocalOffer(kOffer, options), "video");
+	EXPECT_EQ(video.lines.front(),
+		  "m=video 9 UDP/TLS/RTP/SAVPF 98 96 97 99 100");
+}
+
+TEST(MungeLocalOffer, PruneDropsTheOtherCodecsWithTheirRtx)
+{
+	SdpMungeOptions options;
+	options.video_codecs = {"H264"};
+	options.prune_video_codecs = true;
+	auto video = Section(MungeLocalOffer(kOffer, options), "video");
+	EXPECT_EQ(video.lines.front(), "m=video 9 UDP/TLS/RTP/SAVPF 98 99 100");
+	EXPECT_FALSE(HasLine(video, "a=rtpmap:96 VP8/90000"));
+	EXPECT_FALSE(HasLine(video, "a=fmtp:97 apt=96"));
+	EXPECT_TRUE(HasLine(video, "a=fmtp:99 apt=98"));
+}
+
+TEST(MungeLocalOffer, PruneKeepsEverythingIfNothingMatches)
+{
+	SdpMungeOptions options;
+	options.video_codecs = {"AV1"};
+	options.prune_video_codecs = true;
+	auto video = Section(MungeLocalOffer(kOffer, options), "video");
+	EXPECT_EQ(video.PayloadTypes().size(), 5u);
+}
+
+TEST(MungeLocalOffer, WithoutNackGoesRtxAndItsSsrcs)
+{
+	SdpMungeOptions options;
+	options.nack = false;
+	auto video = Section(MungeLocalOffer(kOffer, options), "video");
+	EXPECT_EQ(video.lines.front(), "m=video 9 UDP/TLS/RTP/SAVPF 96 98 100");
+	EXPECT_FALSE(HasLine(video, "a=rtcp-fb:96 nack"));
+	EXPECT_TRUE(HasLine(video, "a=rtcp-fb:96 nack pli"));
+	EXPECT_FALSE(HasLine(video, "a=ssrc-group:FID 1111 2222"));
+	EXPECT_FALSE(HasLine(video, "a=ssrc:2222 cname:obs"));
+	EXPECT_TRUE(HasLine(video, "a=ssrc:1111 cname:obs"));
+}
+
+TEST(MungeLocalOffer, WithoutUlpfec)
+{
+	SdpMungeOptions options;
+	options.ulpfec = false;
+	auto video = Section(MungeLocalOffer(kOffer, options), "video");
+	EXPECT_EQ(video.lines.front(),
+		  "m=video 9 UDP/TLS/RTP/SAVPF 96 97 98 99");
+}
+
+TEST(MungeLocalOffer, OpusFecAndRed)
+{
+	SdpMungeOptions options;
+	options.audio_red = true;
+	auto audio = Section(MungeLocalOffer(kOffer, options), "audio");
+	EXPECT_EQ(audio.lines.front(), "m=audio 9 UDP/TLS/RTP/SAVPF 63 111");
+	EXPECT_TRUE(HasLine(audio, "a=fmtp:111 minptime=10;useinbandfec=1"));
+}
+
+TEST(MungeRemoteAnswer, BandwidthAndStartBitrate)
+{
+	SdpMungeOptions options;
+	options.video_bandwidth = 2500;
+	options.start_bitrate = 1200;
+	auto video = Section(MungeRemoteAnswer(kOffer, options), "video");
+	// right after c=
+	ASSERT_GE(video.lines.size(), 4u);
+	EXPECT_EQ(video.lines[1], "c=IN IP4 0.0.0.0");
+	EXPECT_EQ(video.lines[2], "b=AS:2500");
+	EXPECT_EQ(video.lines[3], "b=TIAS:2500000");
+	EXPECT_TRUE(HasLine(video, "a=fmtp:96 x-google-start-bitrate=1200"));
+	EXPECT_TRUE(HasLine(video, "a=fmtp:98 profile-level-id=42e01f;"
+				   "x-google-start-bitrate=1200"));
+	// not on the protection payloads
+	EXPECT_TRUE(HasLine(video, "a=fmtp:97 apt=96"));
+
+	auto audio = Section(MungeRemoteAnswer(kOffer, options), "audio");
+	EXPECT_FALSE(HasLine(audio, "b=AS:2500"));
+}
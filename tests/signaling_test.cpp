@@ -0,0 +1,177 @@
+#include "websocket_client.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "mock_janus.h"
+
+using janus::signaling::MessagePriority;
+using janus::signaling::TlsOptions;
+using janus::signaling::WebsocketClient;
+using janus::signaling::WebsocketClientInterface;
+using janus::test::MockJanus;
+using janus::test::MockJanusOptions;
+
+namespace {
+constexpr auto kTimeout = std::chrono::seconds(5);
+
+class Observer : public WebsocketClientInterface {
+public:
+	// called on the io thread once the connection is up
+	std::function<void()> on_connected;
+
+	void OnConnected() override
+	{
+		if (on_connected)
+			on_connected();
+		Bump(connected_);
+	}
+	void OnConnectionClosed(const std::string &) override
+	{
+		Bump(closed_);
+	}
+	void OnRecvMessage(const std::string &) override { Bump(received_); }
+
+	bool WaitConnected(int count = 1) { return Wait(connected_, count); }
+	bool WaitClosed(int count = 1) { return Wait(closed_, count); }
+	bool WaitReceived(int count = 1) { return Wait(received_, count); }
+
+	int Calls()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return connected_ + closed_ + received_;
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	int connected_ = 0;
+	int closed_ = 0;
+	int received_ = 0;
+
+	void Bump(int &counter)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		counter++;
+		cond_.notify_all();
+	}
+
+	bool Wait(int &counter, int count)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		return cond_.wait_for(lock, kTimeout,
+				      [&]() { return counter >= count; });
+	}
+};
+
+std::string Url(const char *scheme, uint16_t port)
+{
+	return std::string(scheme) + "://127.0.0.1:" + std::to_string(port);
+}
+
+const std::string kCreate = R"({"janus":"create","transaction":"c"})";
+const std::string kClaim =
+	R"({"janus":"claim","session_id":1,"transaction":"r"})";
+} // namespace
+
+TEST(Signaling, ClaimGoesAheadOfWhatWasQueued)
+{
+	MockJanus<websocketpp::config::asio> mock(MockJanusOptions{});
+	mock.Start();
+
+	Observer observer;
+	auto client = std::make_shared<WebsocketClient>();
+	client->AddObserver(&observer);
+	// queued while down, what the plugin does before the reconnect
+	client->SendMsg(kCreate);
+	observer.on_connected = [&]() {
+		client->SendMsg(kClaim, MessagePriority::kFirst);
+	};
+	client->Connect(Url("ws", mock.Port()));
+	ASSERT_TRUE(observer.WaitConnected());
+	ASSERT_TRUE(observer.WaitReceived(2));
+
+	auto requests = mock.Requests();
+	ASSERT_EQ(requests.size(), 2u);
+	EXPECT_EQ(requests[0], "claim");
+	EXPECT_EQ(requests[1], "create");
+	client->Detach();
+}
+
+TEST(Signaling, ServerDropIsReported)
+{
+	MockJanus<websocketpp::config::asio> mock(MockJanusOptions{});
+	mock.Start();
+
+	Observer observer;
+	auto client = std::make_shared<WebsocketClient>();
+	client->AddObserver(&observer);
+	client->Connect(Url("ws", mock.Port()));
+	ASSERT_TRUE(observer.WaitConnected());
+
+	// the janus of the primary going down, the path down of the failover
+	mock.DropAll();
+	EXPECT_TRUE(observer.WaitClosed());
+	EXPECT_FALSE(client->Connected());
+	client->Detach();
+}
+
+TEST(Signaling, NoCallbacksOnceDetached)
+{
+	MockJanus<websocketpp::config::asio> mock(MockJanusOptions{});
+	mock.Start();
+
+	Observer observer;
+	auto client = std::make_shared<WebsocketClient>();
+	client->AddObserver(&observer);
+	client->Connect(Url("ws", mock.Port()));
+	ASSERT_TRUE(observer.WaitConnected());
+
+	client->SendMsg(kCreate);
+	client->Detach();
+	int calls = observer.Calls();
+	// the reply & the close come in after it returned
+	client.reset();
+	mock.DropAll();
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	EXPECT_EQ(observer.Calls(), calls);
+}
+
+#ifdef JANUS_ENABLE_TLS
+TEST(Signaling, TlsReconnectResumesTheSession)
+{
+	MockJanusOptions options;
+	ASSERT_TRUE(janus::test::MakeSelfSignedCertificate(options.tls_cert,
+							   options.tls_key));
+	MockJanus<websocketpp::config::asio_tls> mock(options);
+	mock.UseTls();
+	mock.Start();
+
+	Observer observer;
+	auto client = std::make_shared<WebsocketClient>();
+	client->AddObserver(&observer);
+	TlsOptions tls;
+	tls.verify_peer = false;
+	client->SetTlsOptions(tls);
+
+	for (int i = 1; i <= 2; i++) {
+		client->Connect(Url("wss", mock.Port()));
+		ASSERT_TRUE(observer.WaitConnected(i));
+		// a round trip, the session ticket is in by then
+		client->SendMsg(kCreate);
+		ASSERT_TRUE(observer.WaitReceived(i));
+		client->Close();
+		ASSERT_TRUE(observer.WaitClosed(i));
+	}
+
+	EXPECT_EQ(mock.Opened(), 2u);
+	EXPECT_EQ(mock.Resumed(), 1u);
+	client->Detach();
+}
+#endif
@@ -0,0 +1,33 @@
+#include "util/base.h"
+#include "util/platform.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+// LOG_DEBUG is only printed with JANUS_TEST_VERBOSE set
+void blog(int log_level, const char *format, ...)
+{
+	static const bool verbose = getenv("JANUS_TEST_VERBOSE") != nullptr;
+	if (log_level >= LOG_DEBUG && !verbose)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+uint64_t os_gettime_ns(void)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		       std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+void os_set_thread_name(const char *name)
+{
+	(void)name;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// stands in for libobs' util/base.h in the tests, the log goes to stderr
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	LOG_ERROR = 100,
+	LOG_WARNING = 200,
+	LOG_INFO = 300,
+	LOG_DEBUG = 400,
+};
+
+void blog(int log_level, const char *format, ...);
+
+#ifdef __cplusplus
+}
+#endif
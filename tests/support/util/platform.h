@@ -0,0 +1,16 @@
+#pragma once
+
+// stands in for libobs' util/platform.h in the tests
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t os_gettime_ns(void);
+void os_set_thread_name(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,148 @@
+#include "task_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using janus::TaskQueue;
+using janus::TaskRunner;
+
+namespace {
+// post a marker & wait for everything posted before it
+void Flush(TaskQueue &queue)
+{
+	std::promise<void> done;
+	queue.Post([&done]() { done.set_value(); });
+	done.get_future().wait();
+}
+} // namespace
+
+TEST(TaskQueue, RunsInPostOrder)
+{
+	TaskQueue queue("test");
+	std::vector<int> order;
+	for (int i = 0; i < 100; i++)
+		queue.Post([&order, i]() { order.push_back(i); });
+	Flush(queue);
+
+	ASSERT_EQ(order.size(), 100u);
+	for (int i = 0; i < 100; i++)
+		EXPECT_EQ(order[i], i);
+}
+
+TEST(TaskQueue, DelayedTasksRunByDeadline)
+{
+	TaskQueue queue("test");
+	std::mutex mutex;
+	std::vector<int> order;
+	auto push = [&](int i) {
+		std::lock_guard<std::mutex> lock(mutex);
+		order.push_back(i);
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::promise<void> done;
+	queue.PostDelayed(
+		[&]() {
+			push(2);
+			done.set_value();
+		},
+		60);
+	queue.PostDelayed([&]() { push(1); }, 20);
+	queue.Post([&]() { push(0); });
+	done.get_future().wait();
+
+	EXPECT_GE(std::chrono::steady_clock::now() - start,
+		  std::chrono::milliseconds(60));
+	std::lock_guard<std::mutex> lock(mutex);
+	EXPECT_EQ(order, (std::vector<int>{0, 1, 2}));
+}
+
+TEST(TaskQueue, IsCurrentOnItsThreadOnly)
+{
+	TaskQueue queue("test");
+	EXPECT_FALSE(queue.IsCurrent());
+
+	std::promise<bool> current;
+	queue.Post([&]() { current.set_value(queue.IsCurrent()); });
+	EXPECT_TRUE(current.get_future().get());
+}
+
+TEST(TaskQueue, StopDropsThePendingTasks)
+{
+	std::atomic<bool> ran(false);
+	{
+		TaskQueue queue("test");
+		queue.PostDelayed([&ran]() { ran = true; }, 200);
+		queue.Stop();
+		// ignored once stopped
+		queue.Post([&ran]() { ran = true; });
+	}
+	EXPECT_FALSE(ran);
+}
+
+TEST(TaskRunner, StopLeavesTheOtherRunnersOfTheQueue)
+{
+	TaskQueue queue("test");
+	TaskRunner stopped("stopped", &queue);
+	TaskRunner running("running", &queue);
+
+	std::atomic<int> stopped_runs(0);
+	std::promise<void> blocked;
+	std::promise<void> release;
+	auto released = release.get_future().share();
+	// hold the queue so the tasks below stay pending
+	queue.Post([&blocked, released]() {
+		blocked.set_value();
+		released.wait();
+	});
+	blocked.get_future().wait();
+
+	stopped.Post([&stopped_runs]() { stopped_runs++; });
+	std::promise<void> ran;
+	running.Post([&ran]() { ran.set_value(); });
+	stopped.Stop();
+	release.set_value();
+
+	ran.get_future().wait();
+	Flush(queue);
+	EXPECT_EQ(stopped_runs, 0);
+}
+
+TEST(TaskRunner, StopWaitsForTheRunningTask)
+{
+	TaskQueue queue("test");
+	TaskRunner runner("test", &queue);
+
+	std::atomic<bool> finished(false);
+	std::promise<void> started;
+	runner.Post([&]() {
+		started.set_value();
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		finished = true;
+	});
+	started.get_future().wait();
+	runner.Stop();
+	EXPECT_TRUE(finished);
+}
+
+TEST(TaskRunner, StopFromItsOwnTask)
+{
+	TaskQueue queue("test");
+	TaskRunner runner("test", &queue);
+
+	std::atomic<int> runs(0);
+	runner.Post([&]() {
+		runs++;
+		// does not wait for itself
+		runner.Stop();
+	});
+	runner.Post([&]() { runs++; });
+	Flush(queue);
+	EXPECT_EQ(runs, 1);
+}